@@ -0,0 +1,54 @@
+#!/bin/bash
+# Times every OpenMP schedule on a few classes of view and records the
+# fastest one per class in bench_schedules.txt
+# With "perf" the fastest schedule of each view is run again with MANDEL_PERF=1
+# and its hardware counter report is collected in bench_perf.txt
+# Usage: ./Bench.sh [numThreads [maxIter [perf]]]
+THREADS=${1:-6}
+ITER=${2:-2000}
+PERF=${3:-}
+RESULTS=bench_schedules.txt
+PERFRESULTS=bench_perf.txt
+
+VIEWS=(
+    "overview -0.75 0 3"
+    "seahorse -0.668 0.32 0.02"
+    "filament -0.7436447860 0.1318252536 0.00003"
+)
+
+echo "========================================"
+echo " Compiling programs"
+make mbomp > /dev/null
+
+echo "# view schedule seconds (${THREADS} threads, maxIter ${ITER}, $(hostname))" > $RESULTS
+if [ "$PERF" = "perf" ]
+then
+    echo "# perf counters per view (${THREADS} threads, maxIter ${ITER}, $(hostname))" > $PERFRESULTS
+fi
+for view in "${VIEWS[@]}"
+do
+    set -- $view
+    best=""
+    bestTime=""
+    echo "========================================"
+    echo " View: $1"
+    for schedule in static dynamic guided tasks
+    do
+        t=$(MANDEL_SCHEDULE=$schedule ./mbomp $ITER $2 $3 $4 $THREADS | awk '/Time used for mandelCompute/ {print $5}')
+        echo "   $schedule: $t s"
+        if [ -z "$bestTime" ] || awk "BEGIN {exit !($t < $bestTime)}"
+        then
+            best=$schedule
+            bestTime=$t
+        fi
+    done
+    echo " Best: $best"
+    echo "$1 $best $bestTime" >> $RESULTS
+    if [ "$PERF" = "perf" ]
+    then
+        echo "view $1, $best schedule" >> $PERFRESULTS
+        MANDEL_PERF=1 MANDEL_SCHEDULE=$best ./mbomp $ITER $2 $3 $4 $THREADS | grep '^perf' | tee -a $PERFRESULTS
+    fi
+done
+echo "========================================"
+cat $RESULTS
@@ -41,8 +41,13 @@ mv mandel.png Images/mandelFork_PThreads.png
 
 
 echo "========================================"
-echo " Running OpenMP Program with 6 threads"
-time ./mbomp 10000 -0.668 0.32 0.002 6 > /dev/null
+if [ ! -f mandel.profile ]
+then
+    echo " Tuning OpenMP Program for this machine"
+    ./mbomp tune | tail -1
+fi
+echo " Running OpenMP Program with the tuned profile"
+time ./mbomp 10000 -0.668 0.32 0.002 0 > /dev/null
 echo "========================================"
 
 echo " Running GNUPLOT"
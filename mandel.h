@@ -19,8 +19,125 @@ typedef struct {
 	double complex *carray; // array for storing complex numbers c, dim: WIDTH * HEIGHT
 	int maxIter;  // maximum iterations before confident point is in mandelbrot set
 	int numProcess; //The number of threads to use
+	double xMinLo;  // low parts of xMin and yMax for double-double views, otherwise 0
+	double yMaxLo;
+	double complex *clo; // low parts of carray for double-double views, or NULL
 } Parameters;
 
+typedef struct {
+	void *map;  // the whole mapping, as returned by mmap
+	size_t mapSize;
+	char *base;  // aligned start of the usable part
+	size_t size;
+	int huge;  // 0 normal pages, 1 transparent huge pages, 2 explicit huge pages
+	int reused;  // frames served without remapping
+} Arena;
+
+#define ARENA_PIXELS 1
+#define ARENA_CARRAY 2
+#define ARENA_ITERATIONS 4
+#define ARENA_HISTOGRAM 8
+#define ARENA_ALL (ARENA_PIXELS | ARENA_CARRAY | ARENA_ITERATIONS | ARENA_HISTOGRAM)
+
+typedef struct {
+	char magic[8];  // "MANDCKP1"
+	int width;
+	int height;
+	int maxIter;
+	int tileSize;
+	int numTiles;
+	int distance;  // distance array follows the iterations
+	double xMin;
+	double xMax;
+	double yMin;
+	double yMax;
+	double kr, ki;  // kernel constant, e.g. the Julia c
+	char kernel[32];  // formula name
+	double xMinLo, yMaxLo;  // double-double view corner
+} CheckpointHeader;
+
+typedef struct Pool Pool;  // persistent worker pool (mandel_pool.c)
+
+typedef struct {
+	int first, end;  // items of the band
+	int next __attribute__((aligned(64)));  // first unclaimed item
+} __attribute__((aligned(64))) WorkBand;
+
+typedef struct {
+	char magic[8];  // "MANDITR1" raw counts, "MANDITR2" encoded blocks, "MANDITR3" either with the whole view
+	int width;
+	int height;
+	int maxIter;
+	int bytes;  // 2 (uint16) or 4 (int32) per iteration count
+	int distance;  // float32 distances in pixels follow the counts
+	double xMin;
+	double xMax;
+	double yMin;
+	double yMax;
+	int encoding;  // MANDITR2 and later from here: ITER_RAW (MANDITR3 only), ITER_RLE or ITER_ZLIB
+	int blockRows;  // rows per independently encoded block
+	int numBlocks;
+	int doubleDouble;  // MANDITR3 only from here: c was formed in double-double from the low words
+	double step;  // distance between pixels
+	double xMinLo;  // low parts of xMin and yMax for double-double views, otherwise 0
+	double yMaxLo;
+} IterHeader;
+
+#define ITER_RAW 0	// counts as they are
+#define ITER_RLE 1	// rows delta and run-length coded into varints
+#define ITER_ZLIB 2	// ITER_RLE blocks deflated
+
+typedef struct {
+	char magic[8];  // "MANDSHM2", stored last by the creator once the rest is set
+	int width;
+	int height;
+	int maxIter;
+	int tileRows;  // rows per tile
+	int numTiles;
+	double xMin;
+	double xMax;
+	double yMin;
+	double yMax;
+	double step;
+	size_t size;  // bytes in the whole context, iterations follow the header
+	int next __attribute__((aligned(64)));  // first unclaimed tile
+	int done __attribute__((aligned(64)));  // tiles finished, a process-shared futex word
+} __attribute__((aligned(64))) SharedHeader;
+
+#define SHARED_DONE -1	// tile state once its iterations are in place
+
+typedef struct {
+	SharedHeader *h;  // the mapping
+	int *iterations;  // result buffer inside it, width * height
+	int *state;  // per tile after it: 0 unclaimed, the claiming pid, or SHARED_DONE
+	int fd;
+	int owner;  // created here, so unlinked on close
+	char name[64];  // shm_open name, empty for a memfd
+} SharedRender;
+
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_BRANCH_MISSES 2
+#define PERF_CACHE_MISSES 3
+#define PERF_FP 4
+#define PERF_TASK_CLOCK 5
+#define PERF_COUNTERS 6
+
+typedef struct {
+	int fd[PERF_COUNTERS];  // -1 where the counter is closed or could not be opened
+	int open[PERF_COUNTERS];  // the counter was available
+	int merged;  // sets of counts added in by perfAdd
+	long long value[PERF_COUNTERS];
+} PerfCounters;
+
+typedef struct {
+	long long blocks;  // grid cells with an interior
+	long long predicted;  // cells whose border was tight enough to predict
+	long long pixels;  // interior pixels given a burst or a cycle check
+	long long early;  // pixels that escaped sooner than predicted
+	long long late;  // pixels that ran past the predicted cap
+} PredictStats;
+
 
 /* function prototypes */
 void initialise_lib(Parameters *);
@@ -30,5 +147,70 @@ void histogramColouring_lib(Parameters *p);
 void freeMemory_lib(Parameters p);
 void parrmandelCompute(Parameters *p);
 
+/* colouring helpers (mandel_colour.c) */
+void histogramTable(const long long *histogram, int maxIter, double *table);
+void paletteRGB(double value, unsigned char *rgb);
+
+/* worker placement (mandel_affinity.c) */
+void affinityInit(void);
+void pinWorker(int worker);
+void bandSplit(WorkBand *bands, int numBands, int items, int unit);
+int bandClaim(WorkBand *bands, int numBands, int own, int chunk, int *count);
+void pageRange(const void *base, size_t size, long count, long first, long end, long *from, long *to);
+
+/* render-context arena (mandel_arena.c) */
+void arenaAlloc(Arena *a, Parameters *p, int buffers);
+void arenaFree(Arena *a);
+
+/* real-axis symmetry (mandel_symmetry.c) */
+double gridY(double yMax, double step, int i);
+void gridRows(double yMax, double step, int height, double *ys);
+int symmetryPlan(Parameters *p, int *mirror);
+void symmetryCopy(Parameters *p, const int *mirror);
+
+/* render checkpoints (mandel_checkpoint.c) */
+void checkpointHeader(CheckpointHeader *h, Parameters *p, int tileSize, int numTiles, const char *kernel, double kr, double ki, int distance);
+int checkpointLoad(const char *path, const CheckpointHeader *h, unsigned char *done, Parameters *p, double *distance);
+void checkpointSave(const char *path, const CheckpointHeader *h, const unsigned char *done, Parameters *p, const double *distance);
+
+/* neighbour iteration-bound prediction (mandel_predict.c) */
+void mandelPredict(Parameters *p, int x0, int y0, int w, int h, PredictStats *s);
+void predictAdd(PredictStats *a, const PredictStats *b);
+void predictReport(const PredictStats *s);
+
+/* saved iteration data (mandel_iter.c) */
+void iterSave(Parameters *p, const char *path, const double *distance);
+float *iterLoad(const char *path, Parameters *p, int *doubleDouble);
+
+/* performance counters (mandel_perf.c) */
+void perfOpen(PerfCounters *c);
+void perfStart(PerfCounters *c);
+void perfStop(PerfCounters *c);
+void perfClose(PerfCounters *c);
+void perfAdd(PerfCounters *a, const PerfCounters *b);
+void perfReport(const char *stage, const PerfCounters *c, long long iterations, double flopsPerIter, double peakPerCycle);
+
+/* persistent worker pool (mandel_pool.c) */
+Pool *poolCreate(int numThreads);
+void poolRun(Pool *pool, void (*job)(int worker, void *arg), void *arg);
+void poolDestroy(Pool *pool);
+int poolSize(Pool *pool);
+
+/* shared-memory render context (mandel_shared.c) */
+void sharedCreate(SharedRender *s, Parameters *p, const char *name, int tileRows);
+int sharedAttach(SharedRender *s, const char *name);
+int sharedWork(SharedRender *s);
+void sharedWait(SharedRender *s);
+void sharedClose(SharedRender *s);
+void sharedCompute(Parameters *p, const char *name);
+
+/* region-of-interest rendering (mandel_region.c) */
+void regionRender(Pool *pool, Parameters *p, int x0, int y0, int w, int h);
+void regionPan(Pool *pool, Parameters *p, int dx, int dy);
+
+/* gnuplot text output (mandel_write.c) */
+int formatFixed(char *out, double v);
+void writeDat(Parameters p, const char *path);
+
 
 #endif
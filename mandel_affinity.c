@@ -0,0 +1,168 @@
+// CPU affinity policies for worker threads and forked children
+// Selected with MANDEL_AFFINITY:
+//   compact  - fill the CPUs of one socket before moving to the next
+//   scatter  - round robin the workers across sockets
+//   0,2,4,6  - explicit list, worker i gets the i-th CPU (wrapping around)
+// Unset (or anything else) leaves placement to the scheduler.
+// Work is kept next to its pages with bands: bandSplit cuts the items of a
+// frame (rows, tiles) into one contiguous band per worker, the worker first
+// touches the pages that start in its band (pageRange) and later claims work
+// from its own band first, only moving on to the other bands once it is empty.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>
+#include <stdint.h>
+#include <sched.h>
+#include "mandel.h"
+
+#define MAX_CPUS 1024
+#define PAGE_SIZE 4096
+
+static int cpuOrder[MAX_CPUS];  // CPU for worker i is cpuOrder[i % numCpus]
+static int numCpus = 0;
+
+// physical package (socket) a CPU belongs to, 0 if sysfs does not say
+static int cpuPackage(int cpu)
+{
+	char path[96];
+	FILE *fp;
+	int package = 0;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+	if ((fp = fopen(path, "r")) != NULL) {
+		if (fscanf(fp, "%d", &package) != 1) {
+			package = 0;
+		}
+		fclose(fp);
+	}
+	return package;
+}
+
+// read MANDEL_AFFINITY and work out the CPU order, call once before starting workers
+void affinityInit(void)
+{
+	cpu_set_t allowed;
+	int cpus[MAX_CPUS], packages[MAX_CPUS];
+	int n = 0, cpu, i, j, round, package, maxPackage = 0, placed;
+	char *policy = getenv("MANDEL_AFFINITY"), *list, *tok;
+
+	numCpus = 0;
+	if (policy == NULL || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE && cpu < MAX_CPUS; cpu++) {
+		if (CPU_ISSET(cpu, &allowed)) {
+			cpus[n] = cpu;
+			packages[n] = cpuPackage(cpu);
+			if (packages[n] > maxPackage) {
+				maxPackage = packages[n];
+			}
+			n++;
+		}
+	}
+
+	if (strcmp(policy, "compact") == 0) {
+		for (package = 0; package <= maxPackage; package++) {
+			for (i = 0; i < n; i++) {
+				if (packages[i] == package) {
+					cpuOrder[numCpus++] = cpus[i];
+				}
+			}
+		}
+	}
+	else if (strcmp(policy, "scatter") == 0) {
+		// the round-th CPU of every package in turn
+		for (round = 0, placed = 1; placed; round++) {
+			placed = 0;
+			for (package = 0; package <= maxPackage; package++) {
+				for (i = 0, j = 0; i < n; i++) {
+					if (packages[i] == package && j++ == round) {
+						cpuOrder[numCpus++] = cpus[i];
+						placed = 1;
+						break;
+					}
+				}
+			}
+		}
+	}
+	else if (policy[0] >= '0' && policy[0] <= '9') {
+		if ((list = strdup(policy)) == NULL) {
+			perror("Cannot allocate memory (affinity)");
+			exit(EXIT_FAILURE);
+		}
+		for (tok = strtok(list, ","); tok != NULL && numCpus < MAX_CPUS; tok = strtok(NULL, ",")) {
+			cpuOrder[numCpus++] = atoi(tok);
+		}
+		free(list);
+	}
+
+	if (numCpus > 0) {
+		printf("Affinity %s over %d CPUs\n", policy, numCpus);
+	}
+}
+
+// pin the calling thread (or process) to the CPU the policy gives this worker
+void pinWorker(int worker)
+{
+	cpu_set_t set;
+
+	if (numCpus == 0) {
+		return;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cpuOrder[worker % numCpus], &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		perror("Cannot set CPU affinity");
+	}
+}
+
+// split items into numBands contiguous bands of whole units (e.g. rows of tiles)
+void bandSplit(WorkBand *bands, int numBands, int items, int unit)
+{
+	int units = (items + unit - 1) / unit, k, first, end;
+
+	for (k = 0; k < numBands; k++) {
+		first = (int)((long)units * k / numBands) * unit;
+		end = (int)((long)units * (k + 1) / numBands) * unit;
+		bands[k].first = first < items ? first : items;
+		bands[k].end = end < items ? end : items;
+		bands[k].next = bands[k].first;
+	}
+}
+
+// claim up to chunk items, from band own while it lasts and then from the
+// others in turn; chunk 0 claims half of what the band has left (guided).
+// Returns the first item and sets *count, or -1 once every band is empty.
+int bandClaim(WorkBand *bands, int numBands, int own, int chunk, int *count)
+{
+	int k, b, first, size;
+
+	for (k = 0; k < numBands; k++) {
+		b = (own + k) % numBands;
+		if ((first = __atomic_load_n(&bands[b].next, __ATOMIC_RELAXED)) >= bands[b].end) {
+			continue;
+		}
+		size = chunk > 0 ? chunk : (bands[b].end - first + 1) / 2;
+		if ((first = __atomic_fetch_add(&bands[b].next, size, __ATOMIC_RELAXED)) < bands[b].end) {
+			*count = first + size <= bands[b].end ? size : bands[b].end - first;
+			return first;
+		}
+	}
+	return -1;
+}
+
+// elements [*from, *to) of the count-element array at base are those on the
+// pages that start within elements [first, end), so bands never share a page
+void pageRange(const void *base, size_t size, long count, long first, long end, long *from, long *to)
+{
+	uintptr_t start = (uintptr_t)base;
+
+	*from = first <= 0 ? 0 : (long)(((start + first * size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE - start + size - 1) / size);
+	*to = end >= count ? count : (long)(((start + end * size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE - start + size - 1) / size);
+	*from = *from < count ? *from : count;
+	*to = *to < count ? *to : count;
+}
@@ -0,0 +1,110 @@
+// Render-context arena
+// pixels, carray, iterations and histogram are carved out of one mapping, each
+// slice 64-byte aligned for the simd kernels. The mapping is kept and reused
+// for the next frame whenever it is big enough, so repeated renders of the
+// same size (animation, server) do no allocation and take no new page faults.
+// MANDEL_HUGEPAGES=thp asks for transparent huge pages, =explicit maps from
+// the hugetlbfs pool (falling back to thp if the pool is empty).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <complex.h>
+#include <sys/mman.h>
+#include "mandel.h"
+
+#define ARENA_ALIGN 64	// cache line / widest simd register
+#define HUGE_PAGE (2 * 1024 * 1024)
+
+static size_t alignUp(size_t n, size_t to)
+{
+	return (n + to - 1) / to * to;
+}
+
+// map at least size bytes, aligned to a huge page when huge pages are requested
+static void arenaMap(Arena *a, size_t size)
+{
+	char *policy = getenv("MANDEL_HUGEPAGES");
+	size_t length = alignUp(size, HUGE_PAGE);
+	char *base;
+
+	a->huge = 0;
+	a->map = MAP_FAILED;
+
+	if (policy != NULL && strcmp(policy, "explicit") == 0) {
+		a->map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (a->map != MAP_FAILED) {
+			a->mapSize = length;
+			a->base = a->map;
+			a->size = length;
+			a->huge = 2;
+			return;
+		}
+		perror("No explicit huge pages, using transparent huge pages");
+		policy = "thp";
+	}
+
+	if (policy != NULL && strcmp(policy, "thp") == 0) {
+		// over-map by one huge page so the usable part can start on a 2MB boundary
+		a->mapSize = length + HUGE_PAGE;
+		if ((a->map = mmap(NULL, a->mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+			base = (char *)alignUp((uintptr_t)a->map, HUGE_PAGE);
+			madvise(base, length, MADV_HUGEPAGE);
+			a->base = base;
+			a->size = length;
+			a->huge = 1;
+			return;
+		}
+	}
+
+	a->mapSize = alignUp(size, 4096);
+	if ((a->map = mmap(NULL, a->mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		perror("Cannot allocate memory (arena)");
+		exit(EXIT_FAILURE);
+	}
+	a->base = a->map;
+	a->size = a->mapSize;
+}
+
+// point the buffers selected by the ARENA_* mask at slices of the arena,
+// remapping only when the arena is too small for this frame
+void arenaAlloc(Arena *a, Parameters *p, int buffers)
+{
+	size_t numPixels = (size_t)p->width * p->height;
+	size_t pixels = buffers & ARENA_PIXELS ? alignUp(numPixels * sizeof(double), ARENA_ALIGN) : 0;
+	size_t carray = buffers & ARENA_CARRAY ? alignUp(numPixels * sizeof(double complex), ARENA_ALIGN) : 0;
+	size_t iterations = buffers & ARENA_ITERATIONS ? alignUp(numPixels * sizeof(int), ARENA_ALIGN) : 0;
+	size_t histogram = buffers & ARENA_HISTOGRAM ? alignUp(p->maxIter * sizeof(int), ARENA_ALIGN) : 0;
+	size_t need = pixels + carray + iterations + histogram;
+	char *next;
+
+	if (a->base == NULL || a->size < need) {
+		arenaFree(a);
+		arenaMap(a, need);
+	}
+	else {
+		a->reused++;
+	}
+
+	next = a->base;
+	p->pixels = pixels ? (double *)next : NULL;
+	next += pixels;
+	p->carray = carray ? (double complex *)next : NULL;
+	next += carray;
+	p->iterations = iterations ? (int *)next : NULL;
+	next += iterations;
+	p->histogram = histogram ? (int *)next : NULL;
+}
+
+// give the mapping back to the system
+void arenaFree(Arena *a)
+{
+	if (a->base != NULL) {
+		munmap(a->map, a->mapSize);
+	}
+	a->map = NULL;
+	a->base = NULL;
+	a->size = a->mapSize = 0;
+}
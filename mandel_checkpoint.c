@@ -0,0 +1,98 @@
+// Render checkpoints
+// A checkpoint file holds a header describing the render, one byte per tile
+// saying whether it is finished, the iterations array and, for distance
+// renders, the distance array. It is written to path.tmp, synced and renamed
+// over path, so a process killed while checkpointing leaves the previous
+// checkpoint intact. A render only resumes from a checkpoint whose header
+// matches its own byte for byte.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>
+#include "mandel.h"
+#include <unistd.h>
+
+// fill in the header identifying a render, unused bytes are zeroed so headers compare with memcmp
+void checkpointHeader(CheckpointHeader *h, Parameters *p, int tileSize, int numTiles, const char *kernel, double kr, double ki, int distance)
+{
+	memset(h, 0, sizeof(CheckpointHeader));
+	memcpy(h->magic, "MANDCKP1", 8);
+	h->width = p->width;
+	h->height = p->height;
+	h->maxIter = p->maxIter;
+	h->tileSize = tileSize;
+	h->numTiles = numTiles;
+	h->distance = distance;
+	h->xMin = p->xMin;
+	h->xMax = p->xMax;
+	h->yMin = p->yMin;
+	h->yMax = p->yMax;
+	h->xMinLo = p->clo != NULL ? p->xMinLo : 0.0;
+	h->yMaxLo = p->clo != NULL ? p->yMaxLo : 0.0;
+	h->kr = kr;
+	h->ki = ki;
+	snprintf(h->kernel, sizeof(h->kernel), "%s", kernel);
+}
+
+// load a matching checkpoint into done, iterations and distance (may be NULL),
+// returns the number of finished tiles, 0 if there is no usable checkpoint
+int checkpointLoad(const char *path, const CheckpointHeader *h, unsigned char *done, Parameters *p, double *distance)
+{
+	CheckpointHeader saved;
+	size_t numPixels = (size_t)p->width * p->height;
+	FILE *fp;
+	int t, finished = 0;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		return 0;
+	}
+	if (fread(&saved, sizeof(saved), 1, fp) != 1 || memcmp(&saved, h, sizeof(saved)) != 0) {
+		printf("Checkpoint %s is for a different render, starting afresh\n", path);
+		fclose(fp);
+		return 0;
+	}
+	if (fread(done, 1, h->numTiles, fp) != (size_t)h->numTiles ||
+		fread(p->iterations, sizeof(int), numPixels, fp) != numPixels ||
+		(distance != NULL && fread(distance, sizeof(double), numPixels, fp) != numPixels)) {
+		printf("Checkpoint %s is truncated, starting afresh\n", path);
+		memset(done, 0, h->numTiles);
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+
+	for (t = 0; t < h->numTiles; t++) {
+		finished += done[t];
+	}
+	return finished;
+}
+
+// write the checkpoint atomically, only tiles marked done need valid data
+void checkpointSave(const char *path, const CheckpointHeader *h, const unsigned char *done, Parameters *p, const double *distance)
+{
+	size_t numPixels = (size_t)p->width * p->height;
+	char tmp[4096];
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+		perror("Cannot open checkpoint file");
+		return;
+	}
+	if (fwrite(h, sizeof(CheckpointHeader), 1, fp) != 1 ||
+		fwrite(done, 1, h->numTiles, fp) != (size_t)h->numTiles ||
+		fwrite(p->iterations, sizeof(int), numPixels, fp) != numPixels ||
+		(distance != NULL && fwrite(distance, sizeof(double), numPixels, fp) != numPixels) ||
+		fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+		perror("Cannot write checkpoint file");
+		fclose(fp);
+		unlink(tmp);
+		return;
+	}
+	fclose(fp);
+	if (rename(tmp, path) != 0) {
+		perror("Cannot replace checkpoint file");
+		unlink(tmp);
+	}
+}
@@ -0,0 +1,53 @@
+// Colouring helpers shared by the renderers that never hold the full pixels array
+// histogramTable reproduces histogramColouring_lib bit for bit and paletteRGB
+// reproduces the palette in mandel.gp, so 8-bit output matches the gnuplot images
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <complex.h>
+#include "mandel.h"
+
+// turn a histogram of iteration counts into a colour value per iteration count
+// table[k] is the value histogramColouring_lib would give a pixel with k iterations
+void histogramTable(const long long *histogram, int maxIter, double *table)
+{
+	long long total = 0;
+	double value = 0.0;
+	int k;
+
+	for (k = 0; k < maxIter; k++) {
+		total += histogram[k];
+	}
+
+	// accumulate in the same order as the library so the doubles are identical
+	for (k = 0; k < maxIter; k++) {
+		table[k] = value;
+		value += (double)histogram[k] / (double)total;
+	}
+	table[maxIter - 1] = 0.0; // in the mandelbrot set
+}
+
+// map a colour value in [0,1] onto the mandel.gp palette (0 black, 0.5 blue, 1 white)
+void paletteRGB(double value, unsigned char *rgb)
+{
+	double t;
+
+	if (value < 0.0) {
+		value = 0.0;
+	}
+	if (value > 1.0) {
+		value = 1.0;
+	}
+
+	if (value < 0.5) {
+		rgb[0] = 0;
+		rgb[1] = 0;
+		rgb[2] = (unsigned char)(value * 2.0 * 255.0 + 0.5);
+	}
+	else {
+		t = (value - 0.5) * 2.0;
+		rgb[0] = (unsigned char)(t * 255.0 + 0.5);
+		rgb[1] = rgb[0];
+		rgb[2] = 255;
+	}
+}
@@ -0,0 +1,430 @@
+// Saved iteration data
+// An iteration file holds an IterHeader, one count per pixel in row order as
+// uint16 when maxIter fits and int32 otherwise, and for distance renders one
+// float32 distance in pixels per pixel. Everything is native endian. It is all
+// mbrecolour needs to redo the colouring without computing anything.
+// Files are written as "MANDITR3", whose header has the view's step and the
+// low words of a double-double view. Older files are still read: "MANDITR1"
+// (raw counts) and "MANDITR2" (encoded) stop before those fields, and their
+// step is derived from the view as the renderers that wrote them did.
+// With MANDEL_ITER_ENCODING=rle or zlib the counts are stored encoded instead:
+// blocks of ITER_BLOCK_ROWS rows, each coded on its own so the
+// blocks are encoded in parallel and decoded one at a time while reading.
+// Within a row every count is coded as its difference from the previous one;
+// a run of equal counts (the set, flat bands) becomes a single run-length
+// token. Tokens are LEB128 varints: run << 1 | 1, or zigzag(delta) << 1.
+// zlib then deflates each block at its fastest level. A table of the encoded
+// block sizes (uint32) follows the header, then the blocks, then distances.
+// Every count read is checked to be below maxIter, so a corrupt file fails to
+// load instead of indexing the colouring tables out of bounds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <complex.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define ITER_ROWS 64	// rows converted per write
+#define ITER_BLOCK_ROWS 16	// rows per encoded block
+#define ITER_THREADS 64	// most threads encoding blocks
+#define VARINT_MAX 5	// bytes in the longest token of a 32-bit count
+
+#define RAW_HEADER offsetof(IterHeader, encoding)	// bytes of a MANDITR1 header
+#define BLOCK_HEADER offsetof(IterHeader, step)	// bytes of a MANDITR2 header, doubleDouble was its zeroed padding
+
+typedef struct {
+	const int *iterations;
+	int width, height, blockRows, numBlocks, encoding;
+	unsigned char **block;  // encoded blocks, malloced by the workers
+	uint32_t *size;  // their sizes
+	int next;  // first unclaimed block
+} Encoder;
+
+static unsigned char *putVarint(unsigned char *out, uint64_t v)
+{
+	while (v >= 0x80) {
+		*out++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*out++ = (unsigned char)v;
+	return out;
+}
+
+// delta and run-length code rows of width counts, returns the bytes written
+static size_t encodeRows(const int *in, int width, int rows, unsigned char *out)
+{
+	unsigned char *o = out;
+	int64_t d;
+	int i, j, prev, run;
+
+	for (i = 0; i < rows; i++, in += width) {
+		for (j = 0, prev = 0; j < width; j++) {
+			if (in[j] == prev) {
+				for (run = 1; j + run < width && in[j + run] == prev; run++);
+				o = putVarint(o, (uint64_t)run << 1 | 1);
+				j += run - 1;
+				continue;
+			}
+			d = (int64_t)in[j] - prev;
+			o = putVarint(o, (uint64_t)((d << 1) ^ (d >> 63)) << 1);
+			prev = in[j];
+		}
+	}
+	return o - out;
+}
+
+// decode rows of width counts, -1 if in is not exactly that many or a count
+// is outside 0..maxIter-1
+static int decodeRows(const unsigned char *in, size_t n, int *out, int width, int rows, int maxIter)
+{
+	const unsigned char *end = in + n;
+	uint64_t v, zz;
+	int i, j, prev, shift;
+
+	for (i = 0; i < rows; i++, out += width) {
+		for (j = 0, prev = 0; j < width;) {
+			for (v = 0, shift = 0; ; shift += 7) {
+				if (in == end || shift >= 35) {
+					return -1;
+				}
+				v |= (uint64_t)(*in & 0x7f) << shift;
+				if (!(*in++ & 0x80)) {
+					break;
+				}
+			}
+			if (v & 1) {
+				if ((v >> 1) == 0 || (v >> 1) > (uint64_t)(width - j)) {
+					return -1;
+				}
+				for (uint64_t r = v >> 1; r > 0; r--) {
+					out[j++] = prev;
+				}
+			}
+			else {
+				zz = v >> 1;
+				prev += (int)((zz >> 1) ^ -(zz & 1));
+				if (prev < 0 || prev >= maxIter) {
+					return -1;
+				}
+				out[j++] = prev;
+			}
+		}
+	}
+	return in == end ? 0 : -1;
+}
+
+static void *encodeWorker(void *arg)
+{
+	Encoder *e = (Encoder *)arg;
+	size_t capacity = (size_t)e->blockRows * e->width * VARINT_MAX, n;
+	uLongf packed = compressBound(capacity);
+	unsigned char *rle, *zip = NULL, *out;
+	int b, rows;
+
+	if ((rle = malloc(capacity)) == NULL || (e->encoding == ITER_ZLIB && (zip = malloc(packed)) == NULL)) {
+		perror("Cannot allocate memory (iteration encoder)");
+		exit(EXIT_FAILURE);
+	}
+	while ((b = __atomic_fetch_add(&e->next, 1, __ATOMIC_RELAXED)) < e->numBlocks) {
+		rows = (b + 1) * e->blockRows < e->height ? e->blockRows : e->height - b * e->blockRows;
+		n = encodeRows(&e->iterations[(size_t)b * e->blockRows * e->width], e->width, rows, rle);
+		out = rle;
+		if (e->encoding == ITER_ZLIB) {
+			packed = compressBound(capacity);
+			if (compress2(zip, &packed, rle, n, Z_BEST_SPEED) != Z_OK) {
+				fprintf(stderr, "Cannot compress iteration block\n");
+				exit(EXIT_FAILURE);
+			}
+			out = zip;
+			n = packed;
+		}
+		if ((e->block[b] = malloc(n)) == NULL) {
+			perror("Cannot allocate memory (iteration encoder)");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(e->block[b], out, n);
+		e->size[b] = (uint32_t)n;
+	}
+	free(rle);
+	free(zip);
+	return(NULL);
+}
+
+// encode p->iterations into blocks on up to one thread per CPU and write the
+// size table and the blocks, returns the bytes written
+static size_t encodeBlocks(Parameters *p, IterHeader *h, FILE *fp)
+{
+	Encoder e;
+	pthread_t *thr;
+	size_t total = 0;
+	int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN), b, t;
+
+	e.iterations = p->iterations;
+	e.width = p->width;
+	e.height = p->height;
+	e.blockRows = h->blockRows;
+	e.numBlocks = h->numBlocks;
+	e.encoding = h->encoding;
+	e.next = 0;
+	numThreads = numThreads < 1 ? 1 : numThreads > ITER_THREADS ? ITER_THREADS : numThreads;
+	numThreads = numThreads > e.numBlocks ? e.numBlocks : numThreads;
+	if ((e.block = malloc(e.numBlocks * sizeof(unsigned char *))) == NULL || (e.size = malloc(e.numBlocks * sizeof(uint32_t))) == NULL ||
+		(thr = malloc(numThreads * sizeof(pthread_t))) == NULL) {
+		perror("Cannot allocate memory (iteration encoder)");
+		exit(EXIT_FAILURE);
+	}
+	for (t = 0; t < numThreads; t++) {
+		if (pthread_create(&thr[t], NULL, encodeWorker, &e) != 0) {
+			perror("Cannot create encoder thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (t = 0; t < numThreads; t++) {
+		pthread_join(thr[t], NULL);
+	}
+
+	if (fwrite(e.size, sizeof(uint32_t), e.numBlocks, fp) != (size_t)e.numBlocks) {
+		perror("Cannot write iteration file");
+		exit(EXIT_FAILURE);
+	}
+	for (b = 0; b < e.numBlocks; b++) {
+		if (fwrite(e.block[b], 1, e.size[b], fp) != e.size[b]) {
+			perror("Cannot write iteration file");
+			exit(EXIT_FAILURE);
+		}
+		total += e.size[b];
+		free(e.block[b]);
+	}
+	free(e.block);
+	free(e.size);
+	free(thr);
+	return total + e.numBlocks * sizeof(uint32_t);
+}
+
+// read the blocks following the size table one at a time into p->iterations
+static int decodeBlocks(const IterHeader *h, Parameters *p, FILE *fp)
+{
+	size_t capacity = (size_t)h->blockRows * h->width * VARINT_MAX;
+	uLongf packed;
+	uint32_t *size, largest = 0;
+	unsigned char *in, *rle;
+	int b, rows, status = 0;
+
+	if ((size = malloc(h->numBlocks * sizeof(uint32_t))) == NULL || (rle = malloc(capacity)) == NULL) {
+		perror("Cannot allocate memory (iteration file)");
+		exit(EXIT_FAILURE);
+	}
+	if (fread(size, sizeof(uint32_t), h->numBlocks, fp) != (size_t)h->numBlocks) {
+		free(size);
+		free(rle);
+		return -1;
+	}
+	for (b = 0; b < h->numBlocks; b++) {
+		largest = size[b] > largest ? size[b] : largest;
+	}
+	if ((in = malloc(largest + 1)) == NULL) {
+		perror("Cannot allocate memory (iteration file)");
+		exit(EXIT_FAILURE);
+	}
+
+	for (b = 0; b < h->numBlocks && status == 0; b++) {
+		rows = (b + 1) * h->blockRows < h->height ? h->blockRows : h->height - b * h->blockRows;
+		if (fread(in, 1, size[b], fp) != size[b]) {
+			status = -1;
+		}
+		else if (h->encoding == ITER_ZLIB) {
+			packed = capacity;
+			status = uncompress(rle, &packed, in, size[b]) == Z_OK ? 0 : -1;
+			status = status == 0 ? decodeRows(rle, packed, &p->iterations[(size_t)b * h->blockRows * h->width], h->width, rows, h->maxIter) : -1;
+		}
+		else {
+			status = decodeRows(in, size[b], &p->iterations[(size_t)b * h->blockRows * h->width], h->width, rows, h->maxIter);
+		}
+	}
+	free(size);
+	free(rle);
+	free(in);
+	return status;
+}
+
+// write p->iterations (and distance, if not NULL) to path
+void iterSave(Parameters *p, const char *path, const double *distance)
+{
+	IterHeader h;
+	size_t rowPixels = (size_t)ITER_ROWS * p->width, n, count, encoded = 0;
+	size_t numPixels = (size_t)p->width * p->height;
+	char *env = getenv("MANDEL_ITER_ENCODING");
+	uint16_t *iter16;
+	float *dist;
+	FILE *fp;
+
+	memset(&h, 0, sizeof(h));
+	h.encoding = env == NULL ? ITER_RAW : strcmp(env, "rle") == 0 ? ITER_RLE : strcmp(env, "zlib") == 0 ? ITER_ZLIB : ITER_RAW;
+	memcpy(h.magic, "MANDITR3", 8);
+	h.width = p->width;
+	h.height = p->height;
+	h.maxIter = p->maxIter;
+	h.bytes = p->maxIter <= 65536 ? 2 : 4;
+	h.distance = distance != NULL;
+	h.xMin = p->xMin;
+	h.xMax = p->xMax;
+	h.yMin = p->yMin;
+	h.yMax = p->yMax;
+	h.blockRows = ITER_BLOCK_ROWS;
+	h.numBlocks = (p->height + ITER_BLOCK_ROWS - 1) / ITER_BLOCK_ROWS;
+	h.doubleDouble = p->clo != NULL;
+	h.step = p->step;
+	h.xMinLo = h.doubleDouble ? p->xMinLo : 0.0;
+	h.yMaxLo = h.doubleDouble ? p->yMaxLo : 0.0;
+
+	if ((fp = fopen(path, "wb")) == NULL) {
+		perror("Cannot open iteration file");
+		exit(EXIT_FAILURE);
+	}
+	if ((iter16 = malloc(rowPixels * sizeof(uint16_t))) == NULL || (dist = malloc(rowPixels * sizeof(float))) == NULL) {
+		perror("Cannot allocate memory (iteration file)");
+		exit(EXIT_FAILURE);
+	}
+	if (fwrite(&h, sizeof(h), 1, fp) != 1) {
+		perror("Cannot write iteration file");
+		exit(EXIT_FAILURE);
+	}
+
+	if (h.encoding != ITER_RAW) {
+		encoded = encodeBlocks(p, &h, fp);
+	}
+	for (n = 0; h.encoding == ITER_RAW && n < numPixels; n += count) {
+		count = numPixels - n < rowPixels ? numPixels - n : rowPixels;
+		if (h.bytes == 2) {
+			for (size_t m = 0; m < count; m++) {
+				iter16[m] = (uint16_t)p->iterations[n + m];
+			}
+			if (fwrite(iter16, sizeof(uint16_t), count, fp) != count) {
+				perror("Cannot write iteration file");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (fwrite(&p->iterations[n], sizeof(int), count, fp) != count) {
+			perror("Cannot write iteration file");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (n = 0; distance != NULL && n < numPixels; n += count) {
+		count = numPixels - n < rowPixels ? numPixels - n : rowPixels;
+		for (size_t m = 0; m < count; m++) {
+			dist[m] = distance[n + m] / p->step;
+		}
+		if (fwrite(dist, sizeof(float), count, fp) != count) {
+			perror("Cannot write iteration file");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	free(iter16);
+	free(dist);
+	if (fclose(fp) != 0) {
+		perror("Cannot write iteration file");
+		exit(EXIT_FAILURE);
+	}
+	if (h.encoding == ITER_RAW) {
+		printf("Saved iterations to %s\n", path);
+	}
+	else {
+		printf("Saved iterations to %s (%s, %zu bytes, %.1f:1)\n", path, h.encoding == ITER_ZLIB ? "zlib" : "rle",
+			encoded, (double)numPixels * h.bytes / encoded);
+	}
+}
+
+// read path into p: the view, maxIter and a malloced iterations array, and set
+// *doubleDouble if the render formed c in double-double from the low words;
+// returns the malloced distances in pixels or NULL if the file has none
+float *iterLoad(const char *path, Parameters *p, int *doubleDouble)
+{
+	IterHeader h;
+	size_t numPixels, n;
+	int version;
+	uint16_t *iter16;
+	float *dist = NULL;
+	FILE *fp;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		perror("Cannot open iteration file");
+		exit(EXIT_FAILURE);
+	}
+	memset(&h, 0, sizeof(h));
+	if (fread(&h, RAW_HEADER, 1, fp) != 1) {
+		version = 0;
+	}
+	else {
+		version = memcmp(h.magic, "MANDITR1", 8) == 0 ? 1 : memcmp(h.magic, "MANDITR2", 8) == 0 ? 2 : memcmp(h.magic, "MANDITR3", 8) == 0 ? 3 : 0;
+	}
+	if (version == 0 ||
+		(version >= 2 && fread((char *)&h + RAW_HEADER, (version == 2 ? BLOCK_HEADER : sizeof(h)) - RAW_HEADER, 1, fp) != 1) ||
+		h.width <= 0 || h.height <= 0 || h.maxIter <= 0 || (h.bytes != 2 && h.bytes != 4) || (h.bytes == 2 && h.maxIter > 65536) ||
+		(version == 2 && h.encoding == ITER_RAW) || (version == 3 && !(h.step > 0)) ||
+		(h.encoding != ITER_RAW && (h.encoding < 0 || h.encoding > ITER_ZLIB || h.blockRows <= 0 || h.numBlocks != (h.height + h.blockRows - 1) / h.blockRows))) {
+		fprintf(stderr, "%s is not an iteration file\n", path);
+		exit(EXIT_FAILURE);
+	}
+	p->width = h.width;
+	p->height = h.height;
+	p->maxIter = h.maxIter;
+	p->xMin = h.xMin;
+	p->xMax = h.xMax;
+	p->yMin = h.yMin;
+	p->yMax = h.yMax;
+	// files before MANDITR3 have no step, it is (yMax - yMin) / height in
+	// every program that wrote them; their low words are lost
+	p->step = version == 3 ? h.step : (p->yMax - p->yMin) / p->height;
+	p->xMinLo = version == 3 ? h.xMinLo : 0.0;
+	p->yMaxLo = version == 3 ? h.yMaxLo : 0.0;
+	*doubleDouble = version == 3 && h.doubleDouble;
+	numPixels = (size_t)p->width * p->height;
+
+	if ((p->iterations = malloc(numPixels * sizeof(int))) == NULL ||
+		(h.distance && (dist = malloc(numPixels * sizeof(float))) == NULL)) {
+		perror("Cannot allocate memory (iteration file)");
+		exit(EXIT_FAILURE);
+	}
+	if (h.encoding != ITER_RAW) {
+		if (decodeBlocks(&h, p, fp) != 0) {
+			fprintf(stderr, "%s is truncated or corrupt\n", path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if (h.bytes == 2) {
+		if ((iter16 = malloc(numPixels * sizeof(uint16_t))) == NULL) {
+			perror("Cannot allocate memory (iteration file)");
+			exit(EXIT_FAILURE);
+		}
+		if (fread(iter16, sizeof(uint16_t), numPixels, fp) != numPixels) {
+			fprintf(stderr, "%s is truncated\n", path);
+			exit(EXIT_FAILURE);
+		}
+		for (n = 0; n < numPixels; n++) {
+			p->iterations[n] = iter16[n];
+		}
+		free(iter16);
+	}
+	else if (fread(p->iterations, sizeof(int), numPixels, fp) != numPixels) {
+		fprintf(stderr, "%s is truncated\n", path);
+		exit(EXIT_FAILURE);
+	}
+	for (n = 0; h.encoding == ITER_RAW && n < numPixels; n++) {
+		if (p->iterations[n] < 0 || p->iterations[n] >= p->maxIter) {
+			fprintf(stderr, "%s is corrupt, pixel %zu has %d iterations\n", path, n, p->iterations[n]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (dist != NULL && fread(dist, sizeof(float), numPixels, fp) != numPixels) {
+		fprintf(stderr, "%s is truncated\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+	return dist;
+}
@@ -0,0 +1,154 @@
+// Hardware performance counters
+// perf_event_open counters for the calling thread: cycles, instructions,
+// branch misses, cache misses and FP operations, plus the task clock as a
+// software fallback. Each counter is opened on its own, so one the CPU, the
+// kernel or perf_event_paranoid refuses is just reported as n/a. There is no
+// generic FP event, so FP operations need the CPU's raw event code in
+// MANDEL_PERF_FP (e.g. 0x10c7 for 256-bit packed double on recent Intel);
+// without it the FLOP count comes from the iterations times the flops per
+// iteration of the kernel.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <complex.h>
+#include "mandel.h"
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char *perfNames[PERF_COUNTERS] = {"cycles", "instructions", "branch-misses", "cache-misses", "fp-ops", "task-clock"};
+
+// open the counters for the calling thread, disabled
+void perfOpen(PerfCounters *c)
+{
+	struct perf_event_attr attr;
+	static const uint64_t hardware[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+	static int warned = 0;
+	char *fp = getenv("MANDEL_PERF_FP");
+	int k;
+
+	memset(c, 0, sizeof(PerfCounters));
+	for (k = 0; k < PERF_COUNTERS; k++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		if (k < PERF_FP) {
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = hardware[k];
+		}
+		else if (k == PERF_FP) {
+			if (fp == NULL) {
+				c->fd[k] = -1;
+				c->open[k] = 0;
+				continue;
+			}
+			attr.type = PERF_TYPE_RAW;
+			attr.config = strtoull(fp, NULL, 0);
+		}
+		else {
+			attr.type = PERF_TYPE_SOFTWARE;
+			attr.config = PERF_COUNT_SW_TASK_CLOCK;
+		}
+		c->fd[k] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		c->open[k] = c->fd[k] >= 0;
+		// workers open their counters at the same time, only the first to fail warns
+		if (k == PERF_CYCLES && c->fd[k] < 0 && __atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED) == 0) {
+			printf("perf: no hardware counters (%s), perf_event_paranoid or the CPU may not allow them\n", strerror(errno));
+		}
+	}
+}
+
+void perfStart(PerfCounters *c)
+{
+	for (int k = 0; k < PERF_COUNTERS; k++) {
+		if (c->fd[k] >= 0) {
+			ioctl(c->fd[k], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+// stop counting and add the counts to c->value
+void perfStop(PerfCounters *c)
+{
+	long long count;
+
+	for (int k = 0; k < PERF_COUNTERS; k++) {
+		if (c->fd[k] < 0) {
+			continue;
+		}
+		ioctl(c->fd[k], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(c->fd[k], &count, sizeof(count)) == sizeof(count)) {
+			c->value[k] += count;
+		}
+		ioctl(c->fd[k], PERF_EVENT_IOC_RESET, 0);
+	}
+}
+
+void perfClose(PerfCounters *c)
+{
+	for (int k = 0; k < PERF_COUNTERS; k++) {
+		if (c->fd[k] >= 0) {
+			close(c->fd[k]);
+			c->fd[k] = -1;
+		}
+	}
+}
+
+// add the counts of b into a (zeroed to start with), a counter missing from
+// any of them is reported as missing
+void perfAdd(PerfCounters *a, const PerfCounters *b)
+{
+	for (int k = 0; k < PERF_COUNTERS; k++) {
+		a->open[k] = a->merged == 0 ? b->open[k] : a->open[k] && b->open[k];
+		a->value[k] += b->value[k];
+	}
+	a->merged++;
+}
+
+// one line of raw counts, then the derived rates where the counters allow:
+// IPC, iterations per cycle, and with flopsPerIter (or a counted FP event)
+// the FLOP rate against a peak of peakPerCycle flops per thread per cycle
+void perfReport(const char *stage, const PerfCounters *c, long long iterations, double flopsPerIter, double peakPerCycle)
+{
+	double cycles = c->value[PERF_CYCLES], seconds = c->value[PERF_TASK_CLOCK] / 1e9;
+	double flops = c->open[PERF_FP] ? (double)c->value[PERF_FP] : iterations * flopsPerIter;
+	int k;
+
+	printf("perf %-12s", stage);
+	for (k = 0; k < PERF_COUNTERS; k++) {
+		if (c->open[k]) {
+			printf(" %s %lld", perfNames[k], c->value[k]);
+		}
+		else {
+			printf(" %s n/a", perfNames[k]);
+		}
+	}
+	printf("\n");
+
+	if (c->open[PERF_CYCLES] && cycles > 0) {
+		if (c->open[PERF_INSTRUCTIONS]) {
+			printf("perf %-12s IPC %.2f\n", stage, c->value[PERF_INSTRUCTIONS] / cycles);
+		}
+		if (iterations > 0) {
+			printf("perf %-12s %.3f iterations/cycle\n", stage, iterations / cycles);
+		}
+		if (flops > 0) {
+			printf("perf %-12s %.2f flops/cycle, %.1f%% of the %.0f flops/cycle peak\n", stage,
+				flops / cycles, 100.0 * flops / (cycles * peakPerCycle), peakPerCycle);
+		}
+	}
+	if (c->open[PERF_TASK_CLOCK] && seconds > 0 && iterations > 0) {
+		printf("perf %-12s %.1f Miterations/s", stage, iterations / seconds / 1e6);
+		if (flops > 0) {
+			printf(", %.2f GFLOP/s (%s)", flops / seconds / 1e9, c->open[PERF_FP] ? "counted" : "from iterations");
+		}
+		printf(" per thread second\n");
+	}
+}
@@ -0,0 +1,158 @@
+// Persistent worker pool
+// Threads are created once and then run one job after another. Workers sleep
+// on a generation counter with futex waits: poolRun publishes the job, bumps
+// the generation and wakes them all. Each worker counts itself out of
+// "remaining" with an atomic decrement, and the last one wakes poolRun, so
+// nothing takes a lock. Both futex words and every worker's own state sit on
+// separate cache lines. Waiters spin briefly before sleeping, because the next
+// job is often only microseconds away.
+// Workers are pinned with pinWorker, so call affinityInit first.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <complex.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define CACHE_LINE 64
+#define POOL_SPIN 2000	// polls of a futex word before sleeping on it
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() do { } while (0)
+#endif
+
+typedef struct {
+	pthread_t thread;
+	Pool *pool;
+	int worker;
+} __attribute__((aligned(CACHE_LINE))) PoolWorker;
+
+struct Pool {
+	int numThreads;
+	PoolWorker *workers;
+	void (*job)(int worker, void *arg);
+	void *arg;
+	int stop;
+	int generation __attribute__((aligned(CACHE_LINE)));  // bumped for every job, workers wait on it
+	int remaining __attribute__((aligned(CACHE_LINE)));  // workers still in the job, poolRun waits on it
+};
+
+static void futexWait(int *word, int value)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futexWake(int *word, int count)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// wait until *word is no longer value, returns the new value
+static int waitChange(int *word, int value)
+{
+	int now, spin;
+
+	for (spin = 0; spin < POOL_SPIN; spin++) {
+		if ((now = __atomic_load_n(word, __ATOMIC_ACQUIRE)) != value) {
+			return now;
+		}
+		CPU_RELAX();
+	}
+	while ((now = __atomic_load_n(word, __ATOMIC_ACQUIRE)) == value) {
+		futexWait(word, value);
+	}
+	return now;
+}
+
+static void *poolWorker(void *arg)
+{
+	PoolWorker *w = (PoolWorker *)arg;
+	Pool *pool = w->pool;
+	int seen = 0;
+
+	pinWorker(w->worker);
+	for (;;) {
+		seen = waitChange(&pool->generation, seen);
+		if (pool->stop) {
+			break;
+		}
+		pool->job(w->worker, pool->arg);
+		if (__atomic_sub_fetch(&pool->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+			futexWake(&pool->remaining, 1);
+		}
+	}
+	return(NULL);
+}
+
+// start numThreads workers, waiting for jobs
+Pool *poolCreate(int numThreads)
+{
+	Pool *pool;
+	int i;
+
+	if (posix_memalign((void **)&pool, CACHE_LINE, sizeof(Pool)) != 0 ||
+		posix_memalign((void **)&pool->workers, CACHE_LINE, numThreads * sizeof(PoolWorker)) != 0) {
+		perror("Cannot allocate memory (pool)");
+		exit(EXIT_FAILURE);
+	}
+	pool->numThreads = numThreads;
+	pool->job = NULL;
+	pool->arg = NULL;
+	pool->stop = 0;
+	pool->generation = 0;
+	pool->remaining = 0;
+
+	for (i = 0; i < numThreads; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].worker = i;
+		if (pthread_create(&pool->workers[i].thread, NULL, poolWorker, &pool->workers[i]) != 0) {
+			perror("Cannot create pool thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return pool;
+}
+
+// run job(worker, arg) on every worker and return once all have finished
+void poolRun(Pool *pool, void (*job)(int worker, void *arg), void *arg)
+{
+	int remaining;
+
+	pool->job = job;
+	pool->arg = arg;
+	__atomic_store_n(&pool->remaining, pool->numThreads, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+	futexWake(&pool->generation, INT_MAX);
+
+	while ((remaining = __atomic_load_n(&pool->remaining, __ATOMIC_ACQUIRE)) != 0) {
+		waitChange(&pool->remaining, remaining);
+	}
+}
+
+// stop and join the workers
+void poolDestroy(Pool *pool)
+{
+	int i;
+
+	pool->stop = 1;
+	__atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+	futexWake(&pool->generation, INT_MAX);
+	for (i = 0; i < pool->numThreads; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	free(pool->workers);
+	free(pool);
+}
+
+int poolSize(Pool *pool)
+{
+	return pool->numThreads;
+}
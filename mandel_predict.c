@@ -0,0 +1,191 @@
+// Neighbour iteration-bound prediction
+// A region is first computed along a coarse grid, every PREDICT_BLOCK rows and
+// columns, and the interior of each grid cell is predicted from its border:
+//   - border escaping within a PREDICT_SPREAD wide range [lo, hi]: interior
+//     pixels run lo iterations with no escape test, then carry on with the
+//     naive loop; one still bounded at hi + PREDICT_SPREAD is a late
+//     misprediction
+//   - border entirely in the set: interior pixels run the naive loop watching
+//     for the orbit to repeat exactly (Brent's method), and stop there; one
+//     that escapes is an early misprediction
+//   - anything else is computed naively
+// The results stay exact. The points that survive n iterations form a disc
+// for every n, so an interior pixel normally survives as long as its border.
+// When the burst overshoots the escape instead, that is caught and the pixel
+// is recomputed naively (also an early misprediction). With |c| below
+// PREDICT_RADIUS, |z| > 2 implies |z^2 + c| > 2, so an orbit that escaped
+// during the burst is still outside (or non-finite) at its end. The burst
+// performs the same z * z + c operations as the naive loop, so the orbits match
+// bit for bit. An orbit that repeats a value bit for bit without having
+// escaped cycles forever, which is maxIter - 1 for the naive loop too.
+// MANDEL_PREDICT=1 enables it in mbp and mbomp.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include "mandel.h"
+
+#define PREDICT_BLOCK 8	// grid spacing in pixels
+#define PREDICT_SPREAD 64	// widest border range still predicted, in iterations
+#define PREDICT_RADIUS 1.9	// largest |c| given a burst
+
+// the naive escape-time loop of mandelCompute
+static int escapeNaive(double complex c, int maxIter)
+{
+	double complex z = 0 + 0 * I;
+	int k;
+
+	for (k = 0; k < maxIter; k++) {
+		z = z * z + c;
+		if (cabs(z) > 2.0) {
+			return k;
+		}
+	}
+	return maxIter - 1;
+}
+
+// predicted pixel: lo unchecked iterations, then the naive loop from there
+static int escapePredicted(double complex c, int maxIter, int lo, int cap, PredictStats *s)
+{
+	double complex z = 0 + 0 * I;
+	int k;
+
+	for (k = 0; k < lo; k++) {
+		z = z * z + c;
+	}
+	if (!(cabs(z) <= 2.0)) {
+		s->early++;
+		return escapeNaive(c, maxIter);
+	}
+	for (k = lo; k < maxIter; k++) {
+		z = z * z + c;
+		if (cabs(z) > 2.0) {
+			break;
+		}
+	}
+	if (k > cap) {
+		s->late++;
+	}
+	return k < maxIter ? k : maxIter - 1;
+}
+
+// predicted in the set: the naive loop stopping once the orbit repeats
+static int escapeInterior(double complex c, int maxIter, PredictStats *s)
+{
+	double complex z = 0 + 0 * I, saved = z;
+	int k, steps = 0, window = 1;
+
+	for (k = 0; k < maxIter; k++) {
+		z = z * z + c;
+		if (cabs(z) > 2.0) {
+			s->early++;
+			return k;
+		}
+		if (z == saved) {
+			return maxIter - 1;
+		}
+		if (++steps == window) {
+			saved = z;
+			steps = 0;
+			window *= 2;
+		}
+	}
+	return maxIter - 1;
+}
+
+// compute the w x h region at (x0, y0) of p->iterations, adding to s
+void mandelPredict(Parameters *p, int x0, int y0, int w, int h, PredictStats *s)
+{
+	int *it = p->iterations, width = p->width, maxIter = p->maxIter;
+	int i, j, ra, rb, ca, cb, lo, hi, n;
+
+	// the grid: rows and columns every PREDICT_BLOCK pixels plus the last ones
+	for (i = y0; i < y0 + h; i++) {
+		for (j = x0; j < x0 + w; j++) {
+			if ((i - y0) % PREDICT_BLOCK == 0 || i == y0 + h - 1 || (j - x0) % PREDICT_BLOCK == 0 || j == x0 + w - 1) {
+				it[i * width + j] = escapeNaive(p->carray[i * width + j], maxIter);
+			}
+		}
+	}
+
+	for (ra = y0; ra < y0 + h - 1; ra = rb) {
+		rb = ra + PREDICT_BLOCK < y0 + h - 1 ? ra + PREDICT_BLOCK : y0 + h - 1;
+		for (ca = x0; ca < x0 + w - 1; ca = cb) {
+			cb = ca + PREDICT_BLOCK < x0 + w - 1 ? ca + PREDICT_BLOCK : x0 + w - 1;
+			if (rb - ra < 2 || cb - ca < 2) {
+				continue;  // no interior
+			}
+
+			lo = maxIter;
+			hi = 0;
+			for (j = ca; j <= cb; j++) {
+				n = it[ra * width + j];
+				lo = n < lo ? n : lo;
+				hi = n > hi ? n : hi;
+				n = it[rb * width + j];
+				lo = n < lo ? n : lo;
+				hi = n > hi ? n : hi;
+			}
+			for (i = ra + 1; i < rb; i++) {
+				n = it[i * width + ca];
+				lo = n < lo ? n : lo;
+				hi = n > hi ? n : hi;
+				n = it[i * width + cb];
+				lo = n < lo ? n : lo;
+				hi = n > hi ? n : hi;
+			}
+
+			s->blocks++;
+			if (lo == maxIter - 1) {
+				s->predicted++;
+				for (i = ra + 1; i < rb; i++) {
+					for (j = ca + 1; j < cb; j++) {
+						it[i * width + j] = escapeInterior(p->carray[i * width + j], maxIter, s);
+						s->pixels++;
+					}
+				}
+				continue;
+			}
+			if (hi >= maxIter - 1 || hi - lo > PREDICT_SPREAD) {
+				for (i = ra + 1; i < rb; i++) {
+					for (j = ca + 1; j < cb; j++) {
+						it[i * width + j] = escapeNaive(p->carray[i * width + j], maxIter);
+					}
+				}
+				continue;
+			}
+
+			s->predicted++;
+			for (i = ra + 1; i < rb; i++) {
+				for (j = ca + 1; j < cb; j++) {
+					double complex c = p->carray[i * width + j];
+					if (creal(c) * creal(c) + cimag(c) * cimag(c) < PREDICT_RADIUS * PREDICT_RADIUS) {
+						it[i * width + j] = escapePredicted(c, maxIter, lo, hi + PREDICT_SPREAD, s);
+						s->pixels++;
+					}
+					else {
+						it[i * width + j] = escapeNaive(c, maxIter);
+					}
+				}
+			}
+		}
+	}
+}
+
+// add the counts of b into a
+void predictAdd(PredictStats *a, const PredictStats *b)
+{
+	a->blocks += b->blocks;
+	a->predicted += b->predicted;
+	a->pixels += b->pixels;
+	a->early += b->early;
+	a->late += b->late;
+}
+
+void predictReport(const PredictStats *s)
+{
+	printf("Prediction: %lld of %lld blocks predicted, %lld pixels, %lld early and %lld late mispredictions\n",
+		s->predicted, s->blocks, s->pixels, s->early, s->late);
+}
@@ -0,0 +1,172 @@
+// Region-of-interest rendering
+// regionRender computes any pixel rectangle of a view into its existing
+// iterations buffer, from its carray, with the tiles of just that rectangle
+// shared out over a worker pool. regionPan moves a view by whole pixels: the
+// iterations that are still in view are shifted in place, carray is extended
+// along the same grid, and only the newly exposed strips are computed.
+// New columns on the right and rows at the bottom continue the x += step and
+// y -= step accumulation from the edge, left and up the grid is extended by
+// subtracting (adding) step instead. Away from the rows gridY mirrors about
+// the real axis, a pan right or down therefore matches a full render of the
+// larger frame exactly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>
+#include "mandel.h"
+
+#define REGION_TILE 32	// tile side in pixels, claimed one at a time by the workers
+
+typedef struct {
+	Parameters *p;
+	int x0, y0, w, h;  // the rectangle
+	int tilesX, numTiles;
+	int next __attribute__((aligned(64)));  // first unclaimed tile
+} Region;
+
+// the naive escape-time loop of mandelCompute
+static int escapeNaive(double complex c, int maxIter)
+{
+	double complex z = 0 + 0 * I;
+	int k;
+
+	for (k = 0; k < maxIter; k++) {
+		z = z * z + c;
+		if (cabs(z) > 2.0) {
+			return k;
+		}
+	}
+	return maxIter - 1;
+}
+
+static void regionJob(int worker, void *arg)
+{
+	Region *r = (Region *)arg;
+	Parameters *p = r->p;
+	int tile, ta, tb, ca, cb, i, j;
+
+	(void)worker;
+	while ((tile = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED)) < r->numTiles) {
+		ta = r->y0 + tile / r->tilesX * REGION_TILE;
+		ca = r->x0 + tile % r->tilesX * REGION_TILE;
+		tb = ta + REGION_TILE < r->y0 + r->h ? ta + REGION_TILE : r->y0 + r->h;
+		cb = ca + REGION_TILE < r->x0 + r->w ? ca + REGION_TILE : r->x0 + r->w;
+		for (i = ta; i < tb; i++) {
+			for (j = ca; j < cb; j++) {
+				p->iterations[i * p->width + j] = escapeNaive(p->carray[i * p->width + j], p->maxIter);
+			}
+		}
+	}
+}
+
+// compute the w x h rectangle at column x0, row y0 of p->iterations, clipped to the view
+void regionRender(Pool *pool, Parameters *p, int x0, int y0, int w, int h)
+{
+	Region r;
+
+	if (x0 < 0) {
+		w += x0;
+		x0 = 0;
+	}
+	if (y0 < 0) {
+		h += y0;
+		y0 = 0;
+	}
+	w = x0 + w > p->width ? p->width - x0 : w;
+	h = y0 + h > p->height ? p->height - y0 : h;
+	if (w <= 0 || h <= 0) {
+		return;
+	}
+
+	r.p = p;
+	r.x0 = x0;
+	r.y0 = y0;
+	r.w = w;
+	r.h = h;
+	r.tilesX = (w + REGION_TILE - 1) / REGION_TILE;
+	r.numTiles = r.tilesX * ((h + REGION_TILE - 1) / REGION_TILE);
+	r.next = 0;
+	poolRun(pool, regionJob, &r);
+}
+
+// lay out n grid coordinates in out: out[k] = in[k + shift] where that exists,
+// otherwise extended from the neighbour by delta per pixel
+static void shiftAxis(const double *in, double *out, int n, int shift, double delta)
+{
+	int k;
+
+	for (k = 0; k < n; k++) {
+		if (k + shift >= 0 && k + shift < n) {
+			out[k] = in[k + shift];
+		}
+	}
+	for (k = n - shift; k < n; k++) {  // exposed after the old last one
+		if (k >= 1) {
+			out[k] = out[k - 1] + delta;
+		}
+	}
+	for (k = -shift - 1; k >= 0; k--) {  // exposed before the old first one
+		if (k < n - 1) {
+			out[k] = out[k + 1] - delta;
+		}
+	}
+}
+
+// move the view dx pixels right and dy pixels down, computing only what was not in view
+void regionPan(Pool *pool, Parameters *p, int dx, int dy)
+{
+	int width = p->width, height = p->height, i, j, src;
+	double *xs, *ys, *nx, *ny;
+
+	if (dx >= width || -dx >= width || dy >= height || -dy >= height) {
+		// nothing stays in view, pan in steps that keep the grid
+		regionPan(pool, p, dx / 2, dy / 2);
+		regionPan(pool, p, dx - dx / 2, dy - dy / 2);
+		return;
+	}
+
+	// old and new grid coordinates: x of every column, y of every row
+	if ((xs = malloc(2 * (width + height) * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (pan)");
+		exit(EXIT_FAILURE);
+	}
+	nx = xs + width;
+	ys = nx + width;
+	ny = ys + height;
+	for (j = 0; j < width; j++) {
+		xs[j] = creal(p->carray[j]);
+	}
+	for (i = 0; i < height; i++) {
+		ys[i] = cimag(p->carray[i * width]);
+	}
+	shiftAxis(xs, nx, width, dx, p->step);
+	shiftAxis(ys, ny, height, dy, -p->step);
+
+	// rows move towards the side they come from, so none is overwritten before it is read
+	for (int n = 0; n < height; n++) {
+		i = dy >= 0 ? n : height - 1 - n;
+		src = i + dy;
+		if (src >= 0 && src < height) {
+			if (dx >= 0) {
+				memmove(&p->iterations[i * width], &p->iterations[src * width + dx], (width - dx) * sizeof(int));
+			}
+			else {
+				memmove(&p->iterations[i * width - dx], &p->iterations[src * width], (width + dx) * sizeof(int));
+			}
+		}
+		for (j = 0; j < width; j++) {
+			p->carray[i * width + j] = nx[j] + ny[i] * I;
+		}
+	}
+	p->xMin = nx[0];
+	p->xMax = nx[width - 1] + p->step;
+	p->yMax = ny[0];
+	p->yMin = ny[height - 1] - p->step;
+
+	// the exposed strips: full-height columns, then the rest of the exposed rows
+	regionRender(pool, p, dx >= 0 ? width - dx : 0, 0, dx >= 0 ? dx : -dx, height);
+	regionRender(pool, p, dx >= 0 ? 0 : -dx, dy >= 0 ? height - dy : 0, width - (dx >= 0 ? dx : -dx), dy >= 0 ? dy : -dy);
+
+	free(xs);
+}
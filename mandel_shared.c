@@ -0,0 +1,256 @@
+// Shared-memory render context
+// One mapping holds everything a render needs to be computed by any number of
+// processes: a SharedHeader with the view, dimensions and maxIter, a tile
+// queue (an atomic counter of claimed tiles and one of finished tiles), the
+// iterations buffer the tiles are written straight into and the state of
+// every tile (unclaimed, the pid of the process computing it, or done). Nothing else is
+// shared, c is recomputed from the view with the same grid (gridY) as
+// initialise, so results match the copy-on-write backends exactly.
+// Forked children inherit the mapping. A context created under a shm_open
+// name ("/mandel") can also be attached by independently started processes
+// (mbworker), which simply claim tiles alongside the children. Without a
+// name it lives in an anonymous memfd.
+// Completion is signalled through the process-shared "done" futex word. The
+// creator waits on it SHARED_TIMEOUT seconds at a time; after each timeout it
+// computes any tiles still queued and takes over claimed tiles whose process
+// has died, so a killed mbworker cannot hang the render. A tile is only ever
+// marked done by the process that holds it, so it is counted once.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <complex.h>
+#include "mandel.h"
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHARED_TILE_ROWS 8	// rows per tile, 8 rows of 1000 ints are whole cache lines
+#define SHARED_TIMEOUT 1	// seconds between checks for tiles held by dead processes
+
+// the naive escape-time loop of mandelCompute
+static int escapeNaive(double complex c, int maxIter)
+{
+	double complex z = 0 + 0 * I;
+	int k;
+
+	for (k = 0; k < maxIter; k++) {
+		z = z * z + c;
+		if (cabs(z) > 2.0) {
+			return k;
+		}
+	}
+	return maxIter - 1;
+}
+
+static void mapContext(SharedRender *s, size_t size)
+{
+	void *map;
+
+	if ((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0)) == MAP_FAILED) {
+		perror("Cannot map shared render context");
+		exit(EXIT_FAILURE);
+	}
+	s->h = (SharedHeader *)map;
+	s->iterations = (int *)((char *)map + sizeof(SharedHeader));
+}
+
+// create a context for the view in p, named for shm_open or NULL for a memfd;
+// a stale context left under the same name is replaced
+void sharedCreate(SharedRender *s, Parameters *p, const char *name, int tileRows)
+{
+	int numTiles = (p->height + tileRows - 1) / tileRows;
+	size_t size = sizeof(SharedHeader) + ((size_t)p->width * p->height + numTiles) * sizeof(int);
+	SharedHeader *h;
+
+	memset(s, 0, sizeof(SharedRender));
+	s->owner = 1;
+	if (name != NULL) {
+		snprintf(s->name, sizeof(s->name), "%s", name);
+		shm_unlink(name);
+		s->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	}
+	else {
+		s->fd = memfd_create("mandel", MFD_CLOEXEC);
+	}
+	if (s->fd < 0 || ftruncate(s->fd, size) != 0) {
+		perror("Cannot create shared render context");
+		exit(EXIT_FAILURE);
+	}
+	mapContext(s, size);
+
+	h = s->h;
+	h->width = p->width;
+	h->height = p->height;
+	h->maxIter = p->maxIter;
+	h->tileRows = tileRows;
+	h->numTiles = numTiles;
+	h->xMin = p->xMin;
+	h->xMax = p->xMax;
+	h->yMin = p->yMin;
+	h->yMax = p->yMax;
+	h->step = p->step;
+	h->size = size;
+	h->next = 0;
+	h->done = 0;
+	s->state = s->iterations + (size_t)p->width * p->height;  // zero from ftruncate, every tile unclaimed
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(h->magic, "MANDSHM2", 8);
+}
+
+// attach to the context created under name, -1 if there is none (yet)
+int sharedAttach(SharedRender *s, const char *name)
+{
+	SharedHeader h;
+	struct stat st;
+
+	memset(s, 0, sizeof(SharedRender));
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	if ((s->fd = shm_open(name, O_RDWR, 0)) < 0) {
+		if (errno == ENOENT) {
+			return -1;
+		}
+		perror("Cannot open shared render context");
+		exit(EXIT_FAILURE);
+	}
+	if (fstat(s->fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedHeader) ||
+		pread(s->fd, &h, sizeof(h), 0) != sizeof(h) || memcmp(h.magic, "MANDSHM2", 8) != 0 || h.size != (size_t)st.st_size ||
+		h.size != sizeof(SharedHeader) + ((size_t)h.width * h.height + h.numTiles) * sizeof(int)) {
+		close(s->fd);
+		return -1;  // still being set up
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	mapContext(s, h.size);
+	s->state = s->iterations + (size_t)h.width * h.height;
+	return 0;
+}
+
+// compute a tile held by self and mark it done, returns 0 if it was taken
+// over meanwhile (then the tile is counted by whoever took it)
+static int computeTile(SharedRender *s, int tile, int self)
+{
+	SharedHeader *h = s->h;
+	int first, last, i, j;
+	double x, y;
+
+	first = tile * h->tileRows;
+	last = first + h->tileRows < h->height ? first + h->tileRows : h->height;
+
+	// the rows of gridY, so c is the same as in a serial fill
+	for (i = first; i < last; i++) {
+		y = gridY(h->yMax, h->step, i);
+		x = h->xMin;
+		for (j = 0; j < h->width; j++) {
+			s->iterations[i * h->width + j] = escapeNaive(x + y * I, h->maxIter);
+			x += h->step;
+		}
+	}
+
+	if (!__atomic_compare_exchange_n(&s->state[tile], &self, SHARED_DONE, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	if (__atomic_add_fetch(&h->done, 1, __ATOMIC_RELEASE) == h->numTiles) {
+		syscall(SYS_futex, &h->done, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+	return 1;
+}
+
+// claim and compute tiles until the queue is empty, returns the number computed
+int sharedWork(SharedRender *s)
+{
+	SharedHeader *h = s->h;
+	int tile, unclaimed, self = getpid(), done = 0;
+
+	while ((tile = __atomic_fetch_add(&h->next, 1, __ATOMIC_RELAXED)) < h->numTiles) {
+		unclaimed = 0;
+		if (__atomic_compare_exchange_n(&s->state[tile], &unclaimed, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			done += computeTile(s, tile, self);
+		}
+	}
+	return done;
+}
+
+// compute the tiles still queued, then take over every claimed tile that is
+// not done and whose process no longer exists (or died before recording
+// itself), returns the number taken over
+static int sharedReclaim(SharedRender *s)
+{
+	int tile, owner, last, self = getpid(), taken = 0;
+
+	sharedWork(s);
+	last = __atomic_load_n(&s->h->next, __ATOMIC_RELAXED);
+	last = last < s->h->numTiles ? last : s->h->numTiles;
+	for (tile = 0; tile < last; tile++) {
+		owner = __atomic_load_n(&s->state[tile], __ATOMIC_ACQUIRE);
+		if (owner == SHARED_DONE || (owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH))) {
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&s->state[tile], &owner, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			computeTile(s, tile, self);
+			taken++;
+		}
+	}
+	return taken;
+}
+
+// wait until every tile has been finished, by whichever process claimed it,
+// taking over the tiles of dead processes every SHARED_TIMEOUT seconds
+void sharedWait(SharedRender *s)
+{
+	struct timespec timeout = {SHARED_TIMEOUT, 0};
+	int done, taken;
+
+	while ((done = __atomic_load_n(&s->h->done, __ATOMIC_ACQUIRE)) < s->h->numTiles) {
+		if (syscall(SYS_futex, &s->h->done, FUTEX_WAIT, done, &timeout, NULL, 0) != 0 && errno == ETIMEDOUT &&
+			(taken = sharedReclaim(s)) > 0) {
+			printf("Took over %d tiles of exited workers\n", taken);
+			fflush(stdout);
+		}
+	}
+}
+
+void sharedClose(SharedRender *s)
+{
+	munmap(s->h, s->h->size);
+	close(s->fd);
+	if (s->owner && s->name[0] != '\0') {
+		shm_unlink(s->name);
+	}
+}
+
+// compute p->iterations with p->numProcess forked children working on one
+// shared context; with a name ("/mandel"), mbworker processes can join in
+void sharedCompute(Parameters *p, const char *name)
+{
+	SharedRender s;
+	int i, tiles;
+
+	sharedCreate(&s, p, name, SHARED_TILE_ROWS);
+	printf("Shared render context %s: %d tiles of %d rows\n", name != NULL ? name : "(memfd)", s.h->numTiles, s.h->tileRows);
+	fflush(stdout);
+
+	for (i = 0; i < p->numProcess; i++) {
+		if (fork() == 0) {
+			pinWorker(i);
+			tiles = sharedWork(&s);
+			printf("Process %d Finished %d tiles!\n", i, tiles);
+			exit(EXIT_SUCCESS);
+		}
+	}
+	for (i = 0; i < p->numProcess; i++) {
+		wait(NULL);
+	}
+	sharedWait(&s);  // tiles claimed by attached workers may still be running
+
+	memcpy(p->iterations, s.iterations, (size_t)p->width * p->height * sizeof(int));
+	sharedClose(&s);
+}
@@ -0,0 +1,135 @@
+// Real-axis symmetry
+// The set is symmetric about the real axis and z*z + c commutes with complex
+// conjugation exactly in floating point, so a row whose imaginary values are the
+// exact negation of another row's has the same iteration counts. The rows of
+// every renderer come from gridRows/gridY: y -= step accumulated from yMax,
+// except that when the view straddles the axis on a whole number of steps
+// (every view centred on it), each row below the axis whose mirror row is in
+// range takes that row's value negated, exactly. symmetryPlan pairs those rows
+// and symmetryCopy copies their counts, which is exactly what computing them
+// gives, so the result does not depend on it. MANDEL_SYMMETRY=0 computes every
+// row anyway.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include "mandel.h"
+
+#define GRID_SLACK 1e-6	// 2 * yMax / step this close to a whole number puts the rows on the mirror
+
+// rows from the top row to its mirror image when the view straddles the real
+// axis on whole steps, otherwise -1
+static long mirrorSpan(double yMax, double step)
+{
+	double k = 2 * yMax / step;
+	long span;
+
+	if (!(yMax > 0.0) || !(step > 0.0) || !(k < 2e9)) {
+		return -1;
+	}
+	span = (long)(k + 0.5);
+	return span >= 1 && fabs(k - span) < GRID_SLACK ? span : -1;
+}
+
+// imaginary value of row i of a view, the same value gridRows gives
+double gridY(double yMax, double step, int i)
+{
+	long span = mirrorSpan(yMax, step);
+	double y = yMax;
+	long n, from = 0;
+
+	if (span >= 1 && 2L * i > span) {
+		if (i <= span) {
+			return -gridY(yMax, step, (int)(span - i));
+		}
+		y = -yMax;  // row span mirrors the top row, the rows below continue from it
+		from = span;
+	}
+	for (n = from; n < i; n++) {
+		y -= step;
+	}
+	return y;
+}
+
+// imaginary value of every row of a view: y -= step accumulated from yMax,
+// rows below the axis with a mirror row above are its exact negation
+void gridRows(double yMax, double step, int height, double *ys)
+{
+	long span = mirrorSpan(yMax, step);
+	int i;
+
+	for (i = 0; i < height; i++) {
+		if (span >= 1 && 2L * i > span && i <= span) {
+			ys[i] = -ys[span - i];
+		}
+		else {
+			ys[i] = i == 0 ? yMax : ys[i - 1] - step;
+		}
+	}
+}
+
+// fill mirror[i] with the row that row i can be copied from, or -1 if row i
+// has to be computed; returns the number of rows that have to be computed
+int symmetryPlan(Parameters *p, int *mirror)
+{
+	char *env = getenv("MANDEL_SYMMETRY");
+	double *ys;
+	int i, lo, hi, mid, rows = p->height;
+
+	for (i = 0; i < p->height; i++) {
+		mirror[i] = -1;
+	}
+	if ((env != NULL && strcmp(env, "0") == 0) || !(p->yMax > 0.0 && p->yMin < 0.0)) {
+		return rows;
+	}
+
+	if ((ys = malloc(p->height * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (symmetry)");
+		exit(EXIT_FAILURE);
+	}
+	gridRows(p->yMax, p->step, p->height, ys);
+
+	// ys is decreasing, so the partner of a row below the axis is found by bisection above it
+	for (i = 0; i < p->height; i++) {
+		if (ys[i] >= 0.0) {
+			continue;
+		}
+		lo = 0;
+		hi = i - 1;
+		while (lo < hi) {
+			mid = (lo + hi + 1) / 2;
+			if (ys[mid] >= -ys[i]) {
+				lo = mid;
+			}
+			else {
+				hi = mid - 1;
+			}
+		}
+		// lo is the last row at or above the mirror, lo + 1 the first below it
+		for (mid = lo; mid <= lo + 1 && mid < i; mid++) {
+			if (ys[mid] > 0.0 && mirror[mid] < 0 && ys[mid] == -ys[i]) {
+				mirror[i] = mid;
+				rows--;
+				break;
+			}
+		}
+	}
+
+	free(ys);
+	return rows;
+}
+
+// copy every mirrored row of iterations from its partner, its c already is the
+// partner's conjugate
+void symmetryCopy(Parameters *p, const int *mirror)
+{
+	int i;
+
+	for (i = 0; i < p->height; i++) {
+		if (mirror[i] >= 0) {
+			memcpy(&p->iterations[i * p->width], &p->iterations[mirror[i] * p->width], p->width * sizeof(int));
+		}
+	}
+}
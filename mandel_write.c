@@ -0,0 +1,204 @@
+// Parallel gnuplot text writer
+// Produces exactly the bytes of the fprintf("%.12lf %.12lf %.12lf\n") loop in
+// writeToFile: blocks of rows are formatted by several threads into their own
+// buffers with formatFixed, and each block is written with one write call as
+// soon as the blocks before it are out.
+// formatFixed rounds exactly like printf: |v| * 10^12 is computed exactly in
+// 128-bit integer arithmetic and rounded half to even. NaN, infinity and
+// magnitudes of FIXED_LIMIT and above go through snprintf.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <complex.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define BLOCK_ROWS 16	// rows formatted per block
+#define MAX_WRITERS 16	// formatting threads
+#define FIXED_LIMIT 1e6	// largest magnitude formatted by hand
+#define LINE_BYTES 3 * 330	// worst case of three "%.12lf" fields
+
+#define SCALE 1000000000000ULL	// 10^12
+
+typedef struct {
+	Parameters *p;
+	int fd;
+	int numBlocks;
+	int nextBlock;  // next block to format
+	int nextWrite;  // next block to write
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} Writer;
+
+// write v as "%.12lf" would into out, return the number of characters
+int formatFixed(char *out, double v)
+{
+	union { double d; uint64_t u; } bits = { v };
+	int exponent = (int)((bits.u >> 52) & 0x7ff);
+	uint64_t mantissa = bits.u & 0xfffffffffffffULL;
+	unsigned __int128 n, q, r, half;
+	uint64_t whole, frac;
+	char digits[24];
+	int length = 0, d, shift;
+
+	if (!(fabs(v) < FIXED_LIMIT)) {
+		return sprintf(out, "%.12lf", v);
+	}
+
+	// v = mantissa * 2^exponent with an integer mantissa
+	if (exponent == 0) {
+		exponent = 1 - 1075;
+	}
+	else {
+		mantissa |= 1ULL << 52;
+		exponent -= 1075;
+	}
+
+	n = (unsigned __int128)mantissa * SCALE;
+	if (exponent >= 0) {
+		q = n << exponent;
+	}
+	else if (exponent <= -127) {
+		q = 0;  // n < 2^93, far below half a unit in the 12th place
+	}
+	else {
+		shift = -exponent;
+		q = n >> shift;
+		r = n & (((unsigned __int128)1 << shift) - 1);
+		half = (unsigned __int128)1 << (shift - 1);
+		if (r > half || (r == half && (q & 1))) {
+			q++;
+		}
+	}
+
+	if (bits.u >> 63) {
+		out[length++] = '-';  // printf keeps the sign of -0.0 and of values rounding to zero
+	}
+	whole = (uint64_t)(q / SCALE);
+	frac = (uint64_t)(q % SCALE);
+	d = 0;
+	do {
+		digits[d++] = '0' + whole % 10;
+		whole /= 10;
+	} while (whole > 0);
+	while (d > 0) {
+		out[length++] = digits[--d];
+	}
+	out[length++] = '.';
+	for (d = 11; d >= 0; d--) {
+		out[length + d] = '0' + frac % 10;
+		frac /= 10;
+	}
+	return length + 12;
+}
+
+// format rows first..first+rows-1 into buf, return the number of bytes
+static size_t formatRows(Parameters *p, int first, int rows, char *buf)
+{
+	size_t length = 0;
+	double complex c;
+	int i, j;
+
+	for (i = first; i < first + rows; i++) {
+		for (j = 0; j < p->width; j++) {
+			c = p->carray[i * p->width + j];
+			length += formatFixed(buf + length, creal(c));
+			buf[length++] = ' ';
+			length += formatFixed(buf + length, cimag(c));
+			buf[length++] = ' ';
+			length += formatFixed(buf + length, p->pixels[i * p->width + j]);
+			buf[length++] = '\n';
+		}
+		buf[length++] = '\n';
+	}
+	return length;
+}
+
+// format blocks in turn and write each one once every earlier block is out
+static void *writeBlocks(void *arg)
+{
+	Writer *w = (Writer *)arg;
+	Parameters *p = w->p;
+	char *buf;
+	size_t length, done;
+	ssize_t written;
+	int block, rows;
+
+	if ((buf = malloc((size_t)BLOCK_ROWS * (p->width * LINE_BYTES + 1))) == NULL) {
+		perror("Cannot allocate memory (write buffer)");
+		exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		block = w->nextBlock++;
+		pthread_mutex_unlock(&w->lock);
+		if (block >= w->numBlocks) {
+			break;
+		}
+
+		rows = (block + 1) * BLOCK_ROWS < p->height ? BLOCK_ROWS : p->height - block * BLOCK_ROWS;
+		length = formatRows(p, block * BLOCK_ROWS, rows, buf);
+
+		pthread_mutex_lock(&w->lock);
+		while (w->nextWrite != block) {
+			pthread_cond_wait(&w->cond, &w->lock);
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		for (done = 0; done < length; done += written) {
+			if ((written = write(w->fd, buf + done, length - done)) < 0) {
+				perror("Cannot write mandel.dat file");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		pthread_mutex_lock(&w->lock);
+		w->nextWrite = block + 1;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+	}
+	free(buf);
+	return(NULL);
+}
+
+// write coordinates and colour values to path in the gnuplot format of writeToFile
+void writeDat(Parameters p, const char *path)
+{
+	pthread_t thr[MAX_WRITERS];
+	Writer w;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, numThreads;
+
+	w.p = &p;
+	w.numBlocks = (p.height + BLOCK_ROWS - 1) / BLOCK_ROWS;
+	w.nextBlock = 0;
+	w.nextWrite = 0;
+	numThreads = cpus < 1 ? 1 : cpus > MAX_WRITERS ? MAX_WRITERS : (int)cpus;
+	if (numThreads > w.numBlocks) {
+		numThreads = w.numBlocks > 0 ? w.numBlocks : 1;
+	}
+
+	if ((w.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror("Cannot open mandel.dat file");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_cond_init(&w.cond, NULL);
+
+	for (i = 0; i < numThreads; i++) {
+		pthread_create(&thr[i], NULL, writeBlocks, (void *)&w);
+	}
+	for (i = 0; i < numThreads; i++) {
+		pthread_join(thr[i], NULL);
+	}
+
+	pthread_mutex_destroy(&w.lock);
+	pthread_cond_destroy(&w.cond);
+	close(w.fd);
+}
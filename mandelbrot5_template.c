@@ -35,6 +35,8 @@ typedef struct{
 	int start, end;
 } Index;
 
+Arena arena;  // backing store for pixels, carray, iterations and histogram
+
 /* main program – execution begins here */
 int main(int argc, char *argv[])
 {
@@ -69,6 +71,8 @@ int main(int argc, char *argv[])
 	p.maxIter = maxIter;
 	p.height = HEIGHT;
 	p.width = WIDTH;
+	p.xMinLo = p.yMaxLo = 0.0;
+	p.clo = NULL;
 
 	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
 	clock_t start, end;
@@ -83,6 +87,9 @@ int main(int argc, char *argv[])
 	end = clock();
     cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
 	printf("Time used for mandelCompute %f\n", cpu_time_used);
+	if (getenv("MANDEL_SAVE_ITER") != NULL) {
+		iterSave(&p, getenv("MANDEL_SAVE_ITER"), NULL);
+	}
 	start = clock();
 	histogramColouring(&p);
 	end = clock();
@@ -106,10 +113,7 @@ void freeMemory(Parameters p)
 {
 	//freeMemory_lib(p);
 	printf("	-> Freeing Memory <-\n");
-	free(p.pixels);
-	free(p.carray);
-	free(p.iterations);
-	free(p.histogram);
+	arenaFree(&arena);
 }
 
 // write coordinates and values to file for gnuplot
@@ -117,23 +121,7 @@ void writeToFile(Parameters p)
 {
 	//writeToFile_lib(p);
 	printf("	-> Using custom writeToFile <-\n");
-	FILE *fp;
-	double complex c;
-	
-	//Attempt to open the file
-	if((fp = fopen("mandel.dat", "w")) == NULL){
-		perror("Cannot open mandel.dat file");
-		exit(EXIT_FAILURE);
-	}
-
-	for(int i=0; i < p.height; i++){
-		for(int j=0; j < p.width; j++){
-			c = p.carray[i * p.width + j];
-			fprintf(fp, "%.12lf %.12lf %.12lf\n", creal(c), cimag(c), p.pixels[i*p.width + j]);
-		}
-		fprintf(fp, "\n");
-	}
-	fclose(fp);
+	writeDat(p, "mandel.dat");
 }
 
 // compute the colour for each pixel using histogram algorithm
@@ -167,8 +155,19 @@ void mandelCompute(Parameters *p)
 	printf("	-> Using custom mandelCompute <-\n");
 	double complex c, z;
 	int i,j ,k;
+	int *mirror;
+
+	// rows mirrored about the real axis are copied instead of computed
+	if ((mirror = malloc(p->height * sizeof(int))) == NULL) {
+		perror("Cannot allocate memory (symmetry)");
+		exit(EXIT_FAILURE);
+	}
+	printf("Computing %d of %d rows\n", symmetryPlan(p, mirror), p->height);
 
 	for(i=0; i < p->height; i++){
+		if(mirror[i] >= 0){
+			continue;
+		}
 		for(j=0; j < p->width; j++){
 			z = 0 + 0*I;
 			c = p->carray[i * p->width + j];
@@ -184,6 +183,8 @@ void mandelCompute(Parameters *p)
 			}
 		}			
 	}
+	symmetryCopy(p, mirror);
+	free(mirror);
 }
 
 
@@ -195,25 +196,7 @@ void initialise(Parameters *p)
 
 	p->step = (p->yMax - p->yMin) / p->width;
 	
-	if ((p->pixels = malloc(p->width * p->height * sizeof(double))) == NULL) {
-		perror("Cannot allocate memory (pixels)");
-		exit(EXIT_FAILURE);
-	}
-	
-	if ((p->carray = malloc(p->width * p->height * sizeof(double complex))) == NULL) {
-		perror("Cannot allocate memory (pixels)");
-		exit(EXIT_FAILURE);
-	}
-	
-	if ((p->iterations = malloc(p->width * p->height * sizeof(int))) == NULL) {
-		perror("Cannot allocate memory (iterations)");
-		exit(EXIT_FAILURE);
-	}
-	
-	if ((p->histogram = malloc(p->maxIter * sizeof(int))) == NULL) {
-		perror("Cannot allocate memory (histogram)");
-		exit(EXIT_FAILURE);
-	}
+	arenaAlloc(&arena, p, ARENA_ALL);
 	
 	// initialise array with zeros
 	for (i = 0; i < p->height; i++) {
@@ -223,14 +206,13 @@ void initialise(Parameters *p)
 	}
 	
 	// initialise carray with real/imaginary values for c
-	y = p->yMax;
 	for (i = 0; i < p->height; i++) {
+		y = gridY(p->yMax, p->step, i);
 		x = p->xMin;
 		for (j = 0; j < p->width; j++) {
 			p->carray[i * p->width + j] = x + y * I;
 			x += p->step;
 		}
-		y -= p->step;
 	}
 	
 	for (i = 0; i < p->maxIter; i++) {
@@ -0,0 +1,289 @@
+// Mandelbrot set Generation
+// Adaptive supersampling anti-aliasing in the compute stage
+// One sample per pixel is computed and coloured first, then only pixels whose
+// colour differs strongly from a neighbour get extra jittered subsamples,
+// which are coloured with the same histogram and averaged into the pixel.
+// Smooth regions cost one sample, edges cost samples + 1.
+
+// Example coordinates: mbaa 10000 -0.668 0.32 0.02 6 16 0.05
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+#include <unistd.h>
+#include <omp.h>
+
+#define SAMPLES 16	// default subsamples for an edge pixel, rounded to a square grid
+#define THRESHOLD 0.05	// default colour difference that marks a pixel as an edge
+
+/* function prototypes */
+void initialise(Parameters *);
+void mandelCompute(Parameters *);
+void writeToFile(Parameters);
+void histogramColouring(Parameters *p, double *table);
+void antialias(Parameters *p, double *table, int samples, double threshold);
+void freeMemory(Parameters p);
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	int maxIter, numProcess = 2, samples = SAMPLES;
+	double xc, yc, size, threshold = THRESHOLD;
+	double *table;
+	Parameters p;
+
+	if (argc < 2) {
+		printf("Usage: mandelbrot maxIter [x y size numThreads [samples [threshold]]]\n\nUsing default values\n");
+		maxIter = 5000;
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc == 2) {
+		sscanf(argv[1], "%i", &maxIter);
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc >= 6) {
+		sscanf(argv[1], "%i", &maxIter);
+		sscanf(argv[2], "%lf", &xc);
+		sscanf(argv[3], "%lf", &yc);
+		sscanf(argv[4], "%lf", &size);
+		sscanf(argv[5], "%i", &numProcess);
+		if (argc >= 7) {
+			sscanf(argv[6], "%i", &samples);
+		}
+		if (argc >= 8) {
+			sscanf(argv[7], "%lf", &threshold);
+		}
+
+		size = size / 2;
+		p.xMin = xc - size;
+		p.yMin = yc - size;
+		p.xMax = xc + size;
+		p.yMax = yc + size;
+	}
+
+	p.maxIter = maxIter;
+	p.height = HEIGHT;
+	p.width = WIDTH;
+	p.numProcess = numProcess;
+
+	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
+
+	if ((table = malloc(p.maxIter * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (table)");
+		exit(EXIT_FAILURE);
+	}
+
+	initialise(&p);
+	mandelCompute(&p);
+	histogramColouring(&p, table);
+	antialias(&p, table, samples, threshold);
+	writeToFile(p);
+	freeMemory(p);
+	free(table);
+
+	return (0);
+}
+
+// free all dynamic memory in Parameters structure
+void freeMemory(Parameters p)
+{
+	printf("	-> Freeing Memory <-\n");
+	free(p.pixels);
+	free(p.carray);
+	free(p.iterations);
+	free(p.histogram);
+}
+
+// write coordinates and values to file for gnuplot
+void writeToFile(Parameters p)
+{
+	printf("	-> Using custom writeToFile <-\n");
+	writeDat(p, "mandel.dat");
+}
+
+// histogram colouring of the single-sample image, keeps the lookup table so
+// subsamples are coloured exactly like the pixels they are averaged with
+void histogramColouring(Parameters *p, double *table)
+{
+	long long *histogram;
+	int n;
+
+	if ((histogram = calloc(p->maxIter, sizeof(long long))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+	for (n = 0; n < p->width * p->height; n++) {
+		histogram[p->iterations[n]]++;
+	}
+	histogramTable(histogram, p->maxIter, table);
+	for (n = 0; n < p->width * p->height; n++) {
+		p->pixels[n] = table[p->iterations[n]];
+	}
+	free(histogram);
+}
+
+// iterate a single point, returns the same count as mandelCompute
+static int mandelPoint(double complex c, int maxIter)
+{
+	double complex z = 0 + 0 * I;
+	int k;
+
+	for (k = 0; k < maxIter; k++) {
+		z = z * z + c;
+		if (cabs(z) > 2.0) {
+			return k;
+		}
+	}
+	return maxIter - 1;
+}
+
+// find edge pixels and replace them with the average of a jittered grid of subsamples
+void antialias(Parameters *p, double *table, int samples, double threshold)
+{
+	unsigned char *edge;
+	int i, j, di, dj, s, t, grid, flagged = 0;
+	double sum, dx, dy, difference;
+	uint32_t seed;
+	double complex c;
+
+	grid = (int)sqrt((double)samples);
+	if (grid < 2) {
+		grid = 2;
+	}
+
+	if ((edge = calloc((size_t)p->width * p->height, 1)) == NULL) {
+		perror("Cannot allocate memory (edges)");
+		exit(EXIT_FAILURE);
+	}
+
+	// flag every pixel whose colour differs strongly from one of its 8 neighbours
+	#pragma omp parallel for num_threads(p->numProcess) private(j, di, dj, difference) reduction(+:flagged) schedule(static)
+	for (i = 0; i < p->height; i++) {
+		for (j = 0; j < p->width; j++) {
+			for (di = -1; di <= 1 && !edge[i * p->width + j]; di++) {
+				for (dj = -1; dj <= 1; dj++) {
+					if (i + di < 0 || i + di >= p->height || j + dj < 0 || j + dj >= p->width) {
+						continue;
+					}
+					difference = fabs(p->pixels[i * p->width + j] - p->pixels[(i + di) * p->width + j + dj]);
+					if (difference > threshold) {
+						edge[i * p->width + j] = 1;
+						flagged++;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// stratified jitter inside the pixel footprint, the original centre sample is kept too
+	#pragma omp parallel for num_threads(p->numProcess) private(j, s, t, sum, dx, dy, seed, c) schedule(dynamic)
+	for (i = 0; i < p->height; i++) {
+		for (j = 0; j < p->width; j++) {
+			if (!edge[i * p->width + j]) {
+				continue;
+			}
+			seed = (uint32_t)(i * p->width + j) * 2654435761u + 1;
+			sum = p->pixels[i * p->width + j];
+			for (s = 0; s < grid; s++) {
+				for (t = 0; t < grid; t++) {
+					seed ^= seed << 13;
+					seed ^= seed >> 17;
+					seed ^= seed << 5;
+					dx = ((t + (seed & 0xffff) / 65536.0) / grid - 0.5) * p->step;
+					dy = ((s + (seed >> 16) / 65536.0) / grid - 0.5) * p->step;
+					c = p->carray[i * p->width + j] + dx - dy * I;
+					sum += table[mandelPoint(c, p->maxIter)];
+				}
+			}
+			p->pixels[i * p->width + j] = sum / (grid * grid + 1);
+		}
+	}
+
+	printf("Anti-aliased %d of %d pixels with %d subsamples, %.2f samples per pixel (uniform: %d)\n",
+		flagged, p->width * p->height, grid * grid,
+		1.0 + (double)flagged * grid * grid / (p->width * p->height), grid * grid);
+	free(edge);
+}
+
+// test each point in the complex plane to see if it is in the set or not
+void mandelCompute(Parameters *p)
+{
+	printf("	-> Using custom mandelCompute <-\n");
+	double complex c, z;
+	int i,j ,k;
+
+	#pragma omp parallel for num_threads(p->numProcess) private(i, j, k, c, z) shared(p) schedule(dynamic)
+	for(i=0; i < p->height; i++){
+		for(j=0; j < p->width; j++){
+			z = 0 + 0*I;
+			c = p->carray[i * p->width + j];
+			for(k=0; k < p->maxIter; k++){
+				z = z * z + c;
+				if(cabs(z) > 2.0){
+					p->iterations[i*p->width + j] = k;
+					break;
+				}
+			}
+			if(k >= p->maxIter){
+				p->iterations[i * p->width + j] = p->maxIter - 1;
+			}
+		}
+	}
+}
+
+// initialise the Parameters structure and dynamically allocate required arrays
+void initialise(Parameters *p)
+{
+	int i, j;
+	double x, y;
+
+	p->step = (p->yMax - p->yMin) / p->width;
+
+	if ((p->pixels = malloc(p->width * p->height * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (pixels)");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((p->carray = malloc(p->width * p->height * sizeof(double complex))) == NULL) {
+		perror("Cannot allocate memory (pixels)");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((p->iterations = malloc(p->width * p->height * sizeof(int))) == NULL) {
+		perror("Cannot allocate memory (iterations)");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((p->histogram = malloc(p->maxIter * sizeof(int))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+
+	// initialise array with zeros
+	for (i = 0; i < p->height; i++) {
+		for (j = 0; j < p->width; j++) {
+			p->pixels[i * p->width + j] = 0.0;
+		}
+	}
+
+	// initialise carray with real/imaginary values for c
+	for (i = 0; i < p->height; i++) {
+		y = gridY(p->yMax, p->step, i);
+		x = p->xMin;
+		for (j = 0; j < p->width; j++) {
+			p->carray[i * p->width + j] = x + y * I;
+			x += p->step;
+		}
+	}
+
+	for (i = 0; i < p->maxIter; i++) {
+		p->histogram[i] = 0;
+	}
+}
@@ -0,0 +1,301 @@
+// Mandelbrot set Generation
+// Batch renderer for many small independent views (thumbnails)
+// Every view of a manifest goes through one persistent worker pool: the tiles
+// of a window of views are put in a single queue that the workers drain,
+// then the workers colour and write the finished views in parallel, one view
+// each at a time, and the next window starts. Iteration buffers belong to the
+// window's slots and the colouring scratch to the workers, and both are only
+// ever grown, so after the first window nothing is allocated.
+// Manifest lines are "x y size maxIter width height output", # starts a
+// comment. An output ending in .iter is saved with iterSave (for mbrecolour),
+// anything else is written as a histogram coloured PPM in the mandel.gp palette.
+
+// Example: mbbatch thumbs.txt 6
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+
+#define BATCH_WINDOW 64	// views in flight
+#define BATCH_ROWS 16	// rows per tile
+
+typedef struct {
+	double x, y, size;
+	int maxIter, width, height;
+	char output[256];
+} View;
+
+typedef struct {
+	Parameters p;  // the view, iterations point at the slot's buffer
+	size_t capacity;  // ints the buffer holds
+	const char *output;
+} Slot;
+
+// colouring scratch of one worker, on cache lines of its own
+typedef struct {
+	long long *histogram;
+	double *table;
+	unsigned char *rgb;
+	int maxIter;  // entries histogram and table hold
+	size_t pixels;  // pixels rgb holds
+} __attribute__((aligned(64))) Scratch;
+
+typedef struct {
+	Slot slots[BATCH_WINDOW];
+	int numSlots;  // views in the current window
+	int *tileSlot, *tileRow;  // the queue: slot and first row of every tile
+	int numTiles, tileCapacity;
+	Scratch *scratch;  // one per worker
+	int next __attribute__((aligned(64)));  // first unclaimed tile, or view when writing
+} Batch;
+
+/* function prototypes */
+View *readManifest(const char *path, int *numViews);
+void setView(Slot *s, const View *v);
+void computeJob(int worker, void *arg);
+void writeJob(int worker, void *arg);
+void writePPM(Parameters *p, const char *path, Scratch *s);
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	struct timespec start, end;
+	int numViews, numThreads = 2, first, i, t, rows;
+	long long pixels = 0;
+	double seconds;
+	View *views;
+	Batch b;
+	Pool *pool;
+
+	if (argc < 2 || (argc >= 3 && (sscanf(argv[2], "%i", &numThreads) != 1 || numThreads < 1))) {
+		printf("Usage: mbbatch manifest [numThreads]\n");
+		exit(EXIT_FAILURE);
+	}
+	views = readManifest(argv[1], &numViews);
+	printf("%d views, %d threads\n", numViews, numThreads);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(&b, 0, sizeof(b));
+	if (posix_memalign((void **)&b.scratch, 64, numThreads * sizeof(Scratch)) != 0) {
+		perror("Cannot allocate memory (scratch)");
+		exit(EXIT_FAILURE);
+	}
+	memset(b.scratch, 0, numThreads * sizeof(Scratch));
+	affinityInit();
+	pool = poolCreate(numThreads);
+
+	for (first = 0; first < numViews; first += b.numSlots) {
+		b.numSlots = numViews - first < BATCH_WINDOW ? numViews - first : BATCH_WINDOW;
+		b.numTiles = 0;
+		for (i = 0; i < b.numSlots; i++) {
+			setView(&b.slots[i], &views[first + i]);
+			rows = b.slots[i].p.height;
+			if (b.numTiles + (rows + BATCH_ROWS - 1) / BATCH_ROWS > b.tileCapacity) {
+				b.tileCapacity = 2 * (b.numTiles + (rows + BATCH_ROWS - 1) / BATCH_ROWS);
+				if ((b.tileSlot = realloc(b.tileSlot, b.tileCapacity * sizeof(int))) == NULL ||
+					(b.tileRow = realloc(b.tileRow, b.tileCapacity * sizeof(int))) == NULL) {
+					perror("Cannot allocate memory (tiles)");
+					exit(EXIT_FAILURE);
+				}
+			}
+			for (t = 0; t < rows; t += BATCH_ROWS) {
+				b.tileSlot[b.numTiles] = i;
+				b.tileRow[b.numTiles++] = t;
+			}
+			pixels += (long long)b.slots[i].p.width * rows;
+		}
+
+		b.next = 0;
+		poolRun(pool, computeJob, &b);
+		b.next = 0;
+		poolRun(pool, writeJob, &b);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("Rendered %d views (%lld pixels) in %f, %.1f views/s\n", numViews, pixels, seconds, numViews / seconds);
+
+	poolDestroy(pool);
+	for (i = 0; i < BATCH_WINDOW; i++) {
+		free(b.slots[i].p.iterations);
+	}
+	for (i = 0; i < numThreads; i++) {
+		free(b.scratch[i].histogram);
+		free(b.scratch[i].table);
+		free(b.scratch[i].rgb);
+	}
+	free(b.scratch);
+	free(b.tileSlot);
+	free(b.tileRow);
+	free(views);
+	return (0);
+}
+
+// read the views of a manifest, exits on a malformed line
+View *readManifest(const char *path, int *numViews)
+{
+	char line[512];
+	int capacity = 64, lineNo = 0;
+	View *views, *v;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror("Cannot open manifest");
+		exit(EXIT_FAILURE);
+	}
+	if ((views = malloc(capacity * sizeof(View))) == NULL) {
+		perror("Cannot allocate memory (manifest)");
+		exit(EXIT_FAILURE);
+	}
+	*numViews = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineNo++;
+		line[strcspn(line, "#")] = '\0';
+		if (strspn(line, " \t\r\n") == strlen(line)) {
+			continue;
+		}
+		if (*numViews == capacity) {
+			capacity *= 2;
+			if ((views = realloc(views, capacity * sizeof(View))) == NULL) {
+				perror("Cannot allocate memory (manifest)");
+				exit(EXIT_FAILURE);
+			}
+		}
+		v = &views[*numViews];
+		if (sscanf(line, "%lf %lf %lf %d %d %d %255s", &v->x, &v->y, &v->size, &v->maxIter, &v->width, &v->height, v->output) != 7 ||
+			v->size <= 0 || v->maxIter < 1 || v->width < 1 || v->height < 1) {
+			fprintf(stderr, "%s:%d: expected x y size maxIter width height output\n", path, lineNo);
+			exit(EXIT_FAILURE);
+		}
+		(*numViews)++;
+	}
+	fclose(fp);
+	return views;
+}
+
+// point a slot at a view, growing its buffer only when the view is larger
+void setView(Slot *s, const View *v)
+{
+	size_t numPixels = (size_t)v->width * v->height;
+	double half = v->size / 2, halfHeight;
+
+	s->p.width = v->width;
+	s->p.height = v->height;
+	s->p.maxIter = v->maxIter;
+	// size spans the width with square pixels; a square view is set up
+	// exactly as main and initialise do in the other renderers
+	halfHeight = v->height == v->width ? half : half * v->height / v->width;
+	s->p.xMin = v->x - half;
+	s->p.xMax = v->x + half;
+	s->p.yMin = v->y - halfHeight;
+	s->p.yMax = v->y + halfHeight;
+	s->p.step = (s->p.yMax - s->p.yMin) / v->height;
+	s->output = v->output;
+	if (numPixels > s->capacity) {
+		free(s->p.iterations);
+		if ((s->p.iterations = malloc(numPixels * sizeof(int))) == NULL) {
+			perror("Cannot allocate memory (iterations)");
+			exit(EXIT_FAILURE);
+		}
+		s->capacity = numPixels;
+	}
+}
+
+// drain the tile queue of the window, c is on the grid of initialise (gridY)
+void computeJob(int worker, void *arg)
+{
+	Batch *b = (Batch *)arg;
+	Parameters *p;
+	double complex c, z;
+	double x, y;
+	int tile, i, j, k, last;
+
+	(void)worker;
+	while ((tile = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->numTiles) {
+		p = &b->slots[b->tileSlot[tile]].p;
+		last = b->tileRow[tile] + BATCH_ROWS < p->height ? b->tileRow[tile] + BATCH_ROWS : p->height;
+		for (i = b->tileRow[tile]; i < last; i++) {
+			y = gridY(p->yMax, p->step, i);
+			x = p->xMin;
+			for (j = 0; j < p->width; j++) {
+				c = x + y * I;
+				z = 0 + 0 * I;
+				for (k = 0; k < p->maxIter; k++) {
+					z = z * z + c;
+					if (cabs(z) > 2.0) {
+						break;
+					}
+				}
+				p->iterations[i * p->width + j] = k < p->maxIter ? k : p->maxIter - 1;
+				x += p->step;
+			}
+		}
+	}
+}
+
+// claim finished views one at a time and write them out
+void writeJob(int worker, void *arg)
+{
+	Batch *b = (Batch *)arg;
+	Slot *s;
+	size_t n;
+	int view;
+
+	while ((view = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->numSlots) {
+		s = &b->slots[view];
+		n = strlen(s->output);
+		if (n >= 5 && strcmp(&s->output[n - 5], ".iter") == 0) {
+			iterSave(&s->p, s->output, NULL);
+		}
+		else {
+			writePPM(&s->p, s->output, &b->scratch[worker]);
+		}
+	}
+}
+
+// histogram colouring and the mandel.gp palette, into the worker's scratch
+void writePPM(Parameters *p, const char *path, Scratch *s)
+{
+	size_t numPixels = (size_t)p->width * p->height, n;
+	FILE *fp;
+
+	if (p->maxIter > s->maxIter) {
+		free(s->histogram);
+		free(s->table);
+		if ((s->histogram = malloc(p->maxIter * sizeof(long long))) == NULL || (s->table = malloc(p->maxIter * sizeof(double))) == NULL) {
+			perror("Cannot allocate memory (histogram)");
+			exit(EXIT_FAILURE);
+		}
+		s->maxIter = p->maxIter;
+	}
+	if (numPixels > s->pixels) {
+		free(s->rgb);
+		if ((s->rgb = malloc(numPixels * 3)) == NULL) {
+			perror("Cannot allocate memory (image)");
+			exit(EXIT_FAILURE);
+		}
+		s->pixels = numPixels;
+	}
+
+	memset(s->histogram, 0, p->maxIter * sizeof(long long));
+	for (n = 0; n < numPixels; n++) {
+		s->histogram[p->iterations[n]]++;
+	}
+	histogramTable(s->histogram, p->maxIter, s->table);
+	for (n = 0; n < numPixels; n++) {
+		paletteRGB(s->table[p->iterations[n]], &s->rgb[n * 3]);
+	}
+
+	if ((fp = fopen(path, "wb")) == NULL) {
+		perror("Cannot open output file");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "P6\n%d %d\n255\n", p->width, p->height);
+	if (fwrite(s->rgb, 3, numPixels, fp) != numPixels || fclose(fp) != 0) {
+		perror("Cannot write output file");
+		exit(EXIT_FAILURE);
+	}
+}
@@ -0,0 +1,525 @@
+// Mandelbrot set Generation
+// Buddhabrot / Anti-Buddhabrot orbit density renderer
+// Random c are drawn from [-2, 2] x [-2, 2] and their orbits traced; the
+// points of escaping orbits (buddha) or of orbits that never escape (anti)
+// that land in the view are counted per pixel. Every worker accumulates into
+// its own density buffer, so there are no atomics or locks while tracing, and
+// the buffers are summed at the end by all workers in parallel, each taking a
+// slice of rows.
+//
+// Backends:
+//   threads - pthreads with private heap buffers
+//   fork    - forked children accumulating into their own region of one
+//             shared mapping, then reducing row slices after a process-shared
+//             barrier
+//
+// Importance sampling: a PRE_SIZE x PRE_SIZE mandelCompute pre-pass over the
+// sampling square finds the cells on the boundary of the set, where nearly
+// all long orbits start. Those cells are sampled 1 / FLOOR_WEIGHT times more
+// often than the rest. Each sample is weighted by uniform / actual probability,
+// so the density has the same expectation as uniform sampling. Orbits of c
+// and conj(c) are mirror images, so every orbit is also counted mirrored.
+
+// Example coordinates: mbbuddha 2000 -0.4 0 3 6 20000000 buddha threads
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+
+#define SAMPLES 2000000	// default number of c to draw
+#define PRE_SIZE 256	// pre-pass cells per side
+#define FLOOR_WEIGHT 0.02	// relative sampling weight of cells away from the boundary
+#define SAMPLE_MIN -2.0	// c is drawn from [SAMPLE_MIN, SAMPLE_MAX]^2
+#define SAMPLE_MAX 2.0
+
+enum{BUDDHA, ANTI};
+
+typedef struct {
+	int size;  // cells per side
+	double cell;  // cell edge
+	double *cdf;  // cumulative sampling weight, dim: size * size
+	double *weight;  // uniform over actual sampling probability per cell, dim: size * size
+} Sampler;
+
+typedef struct {
+	Parameters *p;
+	Sampler *sampler;
+	double **density;  // every worker's accumulation buffer
+	long long samples;  // samples this worker draws
+	long long points;  // orbit points it landed in the view
+	int worker, numWorkers, mode;
+} Worker;
+
+/* function prototypes */
+void initialise(Parameters *p);
+void mandelCompute(Parameters *p);
+void buildSampler(Sampler *s, int mode);
+void traceSamples(Worker *w);
+void reduceRows(Worker *w);
+void *doWork(void *arg);
+void threadsCompute(Parameters *p, Sampler *s, long long samples, int mode);
+void forkCompute(Parameters *p, Sampler *s, long long samples, int mode);
+void densityColouring(Parameters *p, const double *density);
+void freeMemory(Parameters p);
+
+Arena arena;  // backing store for pixels and carray
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	int maxIter, numWorkers = 2, anti;
+	long long samples = SAMPLES;
+	double xc, yc, size;
+	char mode[16] = "buddha", backend[16] = "threads";
+	Parameters p;
+	Sampler s;
+
+	if (argc < 2) {
+		printf("Usage: mandelbrot maxIter [x y size numWorkers [samples [buddha|anti [threads|fork]]]]\n\nUsing default values\n");
+		maxIter = 5000;
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc == 2) {
+		sscanf(argv[1], "%i", &maxIter);
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc >= 6) {
+		sscanf(argv[1], "%i", &maxIter);
+		sscanf(argv[2], "%lf", &xc);
+		sscanf(argv[3], "%lf", &yc);
+		sscanf(argv[4], "%lf", &size);
+		sscanf(argv[5], "%i", &numWorkers);
+		if (argc >= 7) {
+			sscanf(argv[6], "%lld", &samples);
+		}
+		if (argc >= 8) {
+			sscanf(argv[7], "%15s", mode);
+		}
+		if (argc >= 9) {
+			sscanf(argv[8], "%15s", backend);
+		}
+
+		size = size / 2;
+		p.xMin = xc - size;
+		p.yMin = yc - size;
+		p.xMax = xc + size;
+		p.yMax = yc + size;
+	}
+
+	p.maxIter = maxIter;
+	p.height = HEIGHT;
+	p.width = WIDTH;
+	p.numProcess = numWorkers;
+
+	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
+	printf("%lld samples, %s, %d %s\n", samples, strcmp(mode, "anti") == 0 ? "anti-buddhabrot" : "buddhabrot",
+		numWorkers, strcmp(backend, "fork") == 0 ? "processes" : "threads");
+
+	anti = strcmp(mode, "anti") == 0 ? ANTI : BUDDHA;
+	initialise(&p);
+	buildSampler(&s, anti);
+	if (strcmp(backend, "fork") == 0) {
+		forkCompute(&p, &s, samples, anti);
+	}
+	else {
+		threadsCompute(&p, &s, samples, anti);
+	}
+	writeDat(p, "mandel.dat");
+	free(s.cdf);
+	free(s.weight);
+	freeMemory(p);
+
+	return (0);
+}
+
+// free all dynamic memory in Parameters structure
+void freeMemory(Parameters p)
+{
+	printf("	-> Freeing Memory <-\n");
+	arenaFree(&arena);
+}
+
+// initialise the Parameters structure, only pixels and carray are needed
+void initialise(Parameters *p)
+{
+	int i, j;
+	double x, y;
+
+	p->step = (p->yMax - p->yMin) / p->width;
+	arenaAlloc(&arena, p, ARENA_PIXELS | ARENA_CARRAY);
+
+	for (i = 0; i < p->height; i++) {
+		y = gridY(p->yMax, p->step, i);
+		x = p->xMin;
+		for (j = 0; j < p->width; j++) {
+			p->pixels[i * p->width + j] = 0.0;
+			p->carray[i * p->width + j] = x + y * I;
+			x += p->step;
+		}
+	}
+}
+
+// test each point in the complex plane to see if it is in the set or not
+void mandelCompute(Parameters *p)
+{
+	double complex c, z;
+	int i, j, k;
+
+	for (i = 0; i < p->height; i++) {
+		for (j = 0; j < p->width; j++) {
+			z = 0 + 0 * I;
+			c = p->carray[i * p->width + j];
+			for (k = 0; k < p->maxIter; k++) {
+				z = z * z + c;
+				if (cabs(z) > 2.0) {
+					p->iterations[i * p->width + j] = k;
+					break;
+				}
+			}
+			if (k >= p->maxIter) {
+				p->iterations[i * p->width + j] = p->maxIter - 1;
+			}
+		}
+	}
+}
+
+// low resolution pre-pass over the sampling square: cells whose 3x3
+// neighbourhood mixes points inside and outside the set get full weight, as do
+// cells inside the set for the anti-buddhabrot, whose orbits all stay bounded
+void buildSampler(Sampler *s, int mode)
+{
+	Parameters pre;
+	int i, j, di, dj, in, out, n, cells = PRE_SIZE * PRE_SIZE;
+	double total = 0.0, *raw;
+
+	s->size = PRE_SIZE;
+	s->cell = (SAMPLE_MAX - SAMPLE_MIN) / PRE_SIZE;
+
+	// cell centres, so the pre-pass grid is set up by hand rather than by initialise
+	pre.width = pre.height = PRE_SIZE;
+	pre.maxIter = 1000;
+	if ((pre.carray = malloc(cells * sizeof(double complex))) == NULL ||
+		(pre.iterations = malloc(cells * sizeof(int))) == NULL ||
+		(raw = malloc(cells * sizeof(double))) == NULL ||
+		(s->cdf = malloc(cells * sizeof(double))) == NULL ||
+		(s->weight = malloc(cells * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (pre-pass)");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < PRE_SIZE; i++) {
+		for (j = 0; j < PRE_SIZE; j++) {
+			pre.carray[i * PRE_SIZE + j] = (SAMPLE_MIN + (j + 0.5) * s->cell) + (SAMPLE_MIN + (i + 0.5) * s->cell) * I;
+		}
+	}
+	mandelCompute(&pre);
+
+	for (i = 0, n = 0; i < PRE_SIZE; i++) {
+		for (j = 0; j < PRE_SIZE; j++) {
+			in = out = 0;
+			for (di = -1; di <= 1; di++) {
+				for (dj = -1; dj <= 1; dj++) {
+					if (i + di < 0 || i + di >= PRE_SIZE || j + dj < 0 || j + dj >= PRE_SIZE) {
+						out = 1;
+					}
+					else if (pre.iterations[(i + di) * PRE_SIZE + j + dj] == pre.maxIter - 1) {
+						in = 1;
+					}
+					else {
+						out = 1;
+					}
+				}
+			}
+			raw[i * PRE_SIZE + j] = (in && out) || (in && mode == ANTI) ? 1.0 : FLOOR_WEIGHT;
+			n += in && out;
+			total += raw[i * PRE_SIZE + j];
+			s->cdf[i * PRE_SIZE + j] = total;
+		}
+	}
+	for (i = 0; i < cells; i++) {
+		// uniform probability 1 / cells over sampling probability raw / total
+		s->weight[i] = total / (cells * raw[i]);
+	}
+	printf("Pre-pass: %d of %d cells on the boundary\n", n, cells);
+
+	free(raw);
+	free(pre.carray);
+	free(pre.iterations);
+}
+
+// xorshift64*, one stream per worker
+static uint64_t nextRandom(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+// uniform in [0, 1)
+static double uniform(uint64_t *state)
+{
+	return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// draw this worker's samples and add their orbits to its own density buffer
+void traceSamples(Worker *w)
+{
+	Parameters *p = w->p;
+	Sampler *s = w->sampler;
+	double *density = w->density[w->worker];
+	double *ox, *oy, cr, ci, x, y, xn, u, weight;
+	uint64_t state = 0x9E3779B97F4A7C15ULL * (w->worker + 1);
+	long long n, points = 0;
+	int k, length, escaped, cell, lo, hi, mid, row, col, cells = s->size * s->size;
+
+	if ((ox = malloc(p->maxIter * sizeof(double))) == NULL || (oy = malloc(p->maxIter * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (orbit)");
+		exit(EXIT_FAILURE);
+	}
+
+	for (n = 0; n < w->samples; n++) {
+		// pick a cell by its weight, then a point uniformly inside it
+		u = uniform(&state) * s->cdf[cells - 1];
+		lo = 0;
+		hi = cells - 1;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (s->cdf[mid] > u) {
+				hi = mid;
+			}
+			else {
+				lo = mid + 1;
+			}
+		}
+		cell = lo;
+		cr = SAMPLE_MIN + ((cell % s->size) + uniform(&state)) * s->cell;
+		ci = SAMPLE_MIN + ((cell / s->size) + uniform(&state)) * s->cell;
+		weight = s->weight[cell] * 0.5;  // half for the orbit, half for its mirror
+
+		x = y = 0.0;
+		escaped = 0;
+		for (k = 0; k < p->maxIter; k++) {
+			xn = x * x - y * y + cr;
+			y = 2.0 * x * y + ci;
+			x = xn;
+			ox[k] = x;
+			oy[k] = y;
+			if (x * x + y * y > 4.0) {
+				escaped = 1;
+				break;
+			}
+		}
+		if (escaped == (w->mode == ANTI)) {
+			continue;
+		}
+
+		length = escaped ? k : p->maxIter;
+		for (k = 0; k < length; k++) {
+			col = (int)floor((ox[k] - p->xMin) / p->step);
+			if (col < 0 || col >= p->width) {
+				continue;
+			}
+			row = (int)floor((p->yMax - oy[k]) / p->step);
+			if (row >= 0 && row < p->height) {
+				density[row * p->width + col] += weight;
+				points++;
+			}
+			row = (int)floor((p->yMax + oy[k]) / p->step);
+			if (row >= 0 && row < p->height) {
+				density[row * p->width + col] += weight;
+				points++;
+			}
+		}
+	}
+	w->points = points;
+	free(ox);
+	free(oy);
+}
+
+// add every other worker's buffer into buffer 0 for this worker's slice of rows
+void reduceRows(Worker *w)
+{
+	Parameters *p = w->p;
+	size_t first = (size_t)p->height * w->worker / w->numWorkers * p->width;
+	size_t last = (size_t)p->height * (w->worker + 1) / w->numWorkers * p->width;
+	size_t n;
+	int k;
+
+	for (k = 1; k < w->numWorkers; k++) {
+		for (n = first; n < last; n++) {
+			w->density[0][n] += w->density[k][n];
+		}
+	}
+}
+
+void *doWork(void *arg)
+{
+	traceSamples((Worker *)arg);
+	return(NULL);
+}
+
+static void *doReduce(void *arg)
+{
+	reduceRows((Worker *)arg);
+	return(NULL);
+}
+
+// split the samples over workers that each need their own share of them
+static void shareSamples(Worker *workers, Parameters *p, Sampler *s, double **density, long long samples, int mode)
+{
+	int i;
+
+	for (i = 0; i < p->numProcess; i++) {
+		workers[i].p = p;
+		workers[i].sampler = s;
+		workers[i].density = density;
+		workers[i].samples = samples * (i + 1) / p->numProcess - samples * i / p->numProcess;
+		workers[i].points = 0;
+		workers[i].worker = i;
+		workers[i].numWorkers = p->numProcess;
+		workers[i].mode = mode;
+	}
+}
+
+// pthread backend: trace into private heap buffers, then reduce in parallel
+void threadsCompute(Parameters *p, Sampler *s, long long samples, int mode)
+{
+	pthread_t *thr;
+	Worker *workers;
+	double **density;
+	long long points = 0;
+	int i;
+
+	if ((thr = malloc(p->numProcess * sizeof(pthread_t))) == NULL ||
+		(workers = malloc(p->numProcess * sizeof(Worker))) == NULL ||
+		(density = malloc(p->numProcess * sizeof(double *))) == NULL) {
+		perror("Cannot allocate memory (workers)");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < p->numProcess; i++) {
+		if ((density[i] = calloc((size_t)p->width * p->height, sizeof(double))) == NULL) {
+			perror("Cannot allocate memory (density)");
+			exit(EXIT_FAILURE);
+		}
+	}
+	shareSamples(workers, p, s, density, samples, mode);
+
+	for (i = 0; i < p->numProcess; i++) {
+		pthread_create(&thr[i], NULL, doWork, (void *)&workers[i]);
+	}
+	for (i = 0; i < p->numProcess; i++) {
+		pthread_join(thr[i], NULL);
+		points += workers[i].points;
+	}
+	for (i = 0; i < p->numProcess; i++) {
+		pthread_create(&thr[i], NULL, doReduce, (void *)&workers[i]);
+	}
+	for (i = 0; i < p->numProcess; i++) {
+		pthread_join(thr[i], NULL);
+	}
+	printf("Threads Joined, %lld orbit points in view\n", points);
+
+	densityColouring(p, density[0]);
+	for (i = 0; i < p->numProcess; i++) {
+		free(density[i]);
+	}
+	free(density);
+	free(workers);
+	free(thr);
+}
+
+// fork backend: each child traces into its own region of a shared mapping,
+// waits for the others at a process-shared barrier, then reduces its rows
+void forkCompute(Parameters *p, Sampler *s, long long samples, int mode)
+{
+	size_t numPixels = (size_t)p->width * p->height;
+	size_t regionSize = numPixels * sizeof(double);
+	size_t mapSize = sizeof(pthread_barrier_t) + 64 + regionSize * p->numProcess;
+	pthread_barrierattr_t attr;
+	pthread_barrier_t *barrier;
+	Worker *workers;
+	double **density;
+	char *map;
+	long long *points, total = 0;
+	pid_t *pids;
+	int i, status;
+
+	// anonymous shared memory is zero filled, so the regions start empty
+	if ((map = mmap(NULL, mapSize + p->numProcess * sizeof(long long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		perror("Cannot map shared memory (density)");
+		exit(EXIT_FAILURE);
+	}
+	if ((workers = malloc(p->numProcess * sizeof(Worker))) == NULL ||
+		(density = malloc(p->numProcess * sizeof(double *))) == NULL ||
+		(pids = malloc(p->numProcess * sizeof(pid_t))) == NULL) {
+		perror("Cannot allocate memory (workers)");
+		exit(EXIT_FAILURE);
+	}
+	barrier = (pthread_barrier_t *)map;
+	for (i = 0; i < p->numProcess; i++) {
+		density[i] = (double *)(map + sizeof(pthread_barrier_t) + 64 + regionSize * i);
+	}
+	points = (long long *)(map + mapSize);
+
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_barrier_init(barrier, &attr, p->numProcess);
+	pthread_barrierattr_destroy(&attr);
+	shareSamples(workers, p, s, density, samples, mode);
+
+	for (i = 0; i < p->numProcess; i++) {
+		if ((pids[i] = fork()) < 0) {
+			perror("Cannot fork");
+			exit(EXIT_FAILURE);
+		}
+		if (pids[i] == 0) {
+			traceSamples(&workers[i]);
+			points[i] = workers[i].points;
+			pthread_barrier_wait(barrier);
+			reduceRows(&workers[i]);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < p->numProcess; i++) {
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "Worker %d failed\n", i);
+			exit(EXIT_FAILURE);
+		}
+		total += points[i];
+	}
+	printf("Children finished, %lld orbit points in view\n", total);
+
+	densityColouring(p, density[0]);
+	pthread_barrier_destroy(barrier);
+	munmap(map, mapSize + p->numProcess * sizeof(long long));
+	free(pids);
+	free(density);
+	free(workers);
+}
+
+// square-root scaled density in [0, 1]
+void densityColouring(Parameters *p, const double *density)
+{
+	double max = 0.0;
+	int n;
+
+	for (n = 0; n < p->width * p->height; n++) {
+		max = density[n] > max ? density[n] : max;
+	}
+	for (n = 0; n < p->width * p->height; n++) {
+		p->pixels[n] = max > 0.0 ? sqrt(density[n] / max) : 0.0;
+	}
+}
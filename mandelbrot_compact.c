@@ -0,0 +1,399 @@
+// Mandelbrot set Generation
+// Compact iteration buffer with streamed 8-bit RGB output
+// Iteration counts are stored as uint16_t when maxIter < 65536 (int otherwise)
+// and c is generated per row, so carray and the double pixels array are never
+// allocated. Bands of rows are coloured straight to RGB and handed to the
+// writer as soon as they are ready, in order, into a binary PPM.
+//
+// Colouring modes:
+//   hist   - histogram colouring (default), needs the whole frame computed
+//            first so bands stream out during the colouring pass
+//   escape - log escape-time colouring, bands stream out while computing and
+//            no iteration buffer is kept at all
+
+// Example coordinates: mbc 10000 -0.668 0.32 0.002 6 20000 20000 hist
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define BAND_ROWS 16	// rows handed to a thread at a time
+#define BANDS_PER_THREAD 4	// finished bands allowed to queue up behind the writer
+
+enum{HIST, ESCAPE};
+enum{COMPUTE, COLOUR};
+
+typedef struct {
+	Parameters *p;
+	double *xs;  // real value for each column, dim: width
+	double *ys;  // imaginary value for each row, dim: height
+	uint16_t *iter16;  // iteration counts when maxIter < 65536, dim: width * height
+	int *iter32;  // iteration counts otherwise, dim: width * height
+	long long *histogram;  // merged histogram of iteration counts, dim: maxIter
+	double *table;  // colour value for each iteration count, dim: maxIter
+	int colour;  // HIST or ESCAPE
+	int phase;  // COMPUTE or COLOUR
+	int numBands;
+	int nextBand;  // next band to hand out
+	int nextWrite;  // next band the writer is waiting for
+	int window;  // number of band buffers
+	unsigned char **rgb;  // band buffers, band b lives in rgb[b % window]
+	int *ready;  // ready[b % window] set once band b is coloured
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} Stream;
+
+/* function prototypes */
+void initialise(Parameters *p, Stream *s);
+void streamCompute(Stream *s, FILE *fp);
+void *doWork(void *arg);
+int mandelPixel(double complex c, int maxIter);
+void computeBand(Stream *s, int band, long long *histogram);
+void colourBand(Stream *s, int band, unsigned char *rgb);
+void writeBands(Stream *s, FILE *fp);
+void freeMemory(Stream *s);
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	int maxIter, numThreads = 2;
+	double xc, yc, size;
+	char mode[16] = "hist";
+	Parameters p;
+	Stream s;
+	FILE *fp;
+
+	p.width = WIDTH;
+	p.height = HEIGHT;
+
+	if (argc < 2) {
+		printf("Usage: mandelbrot maxIter [x y size numThreads [width height [hist|escape]]]\n\nUsing default values\n");
+		maxIter = 5000;
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc == 2) {
+		sscanf(argv[1], "%i", &maxIter);
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc >= 6) {
+		sscanf(argv[1], "%i", &maxIter);
+		sscanf(argv[2], "%lf", &xc);
+		sscanf(argv[3], "%lf", &yc);
+		sscanf(argv[4], "%lf", &size);
+		sscanf(argv[5], "%i", &numThreads);
+		if (argc >= 8) {
+			sscanf(argv[6], "%i", &p.width);
+			sscanf(argv[7], "%i", &p.height);
+		}
+		if (argc >= 9) {
+			sscanf(argv[8], "%15s", mode);
+		}
+
+		size = size / 2;
+		p.xMin = xc - size;
+		p.yMin = yc - size;
+		p.xMax = xc + size;
+		p.yMax = yc + size;
+	}
+
+	p.maxIter = maxIter;
+	p.numProcess = numThreads;
+	s.colour = strcmp(mode, "escape") == 0 ? ESCAPE : HIST;
+
+	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
+	printf("Image %d x %d, %s colouring, %s iteration storage\n", p.width, p.height,
+		s.colour == HIST ? "histogram" : "escape-time",
+		s.colour == ESCAPE ? "no" : (p.maxIter < 65536 ? "16-bit" : "32-bit"));
+
+	if ((fp = fopen("mandel.ppm", "wb")) == NULL) {
+		perror("Cannot open mandel.ppm file");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "P6\n%d %d\n255\n", p.width, p.height);
+
+	initialise(&p, &s);
+	streamCompute(&s, fp);
+	freeMemory(&s);
+	fclose(fp);
+
+	return (0);
+}
+
+// set up the coordinate tables, compact iteration buffer and band ring
+void initialise(Parameters *p, Stream *s)
+{
+	int i, j;
+	double x;
+	size_t numPixels = (size_t)p->width * p->height;
+
+	p->step = (p->yMax - p->yMin) / p->width;
+	p->carray = NULL;
+	p->pixels = NULL;
+	p->iterations = NULL;
+	p->histogram = NULL;
+
+	s->p = p;
+	s->iter16 = NULL;
+	s->iter32 = NULL;
+	s->numBands = (p->height + BAND_ROWS - 1) / BAND_ROWS;
+	s->window = p->numProcess * BANDS_PER_THREAD;
+
+	if ((s->xs = malloc(p->width * sizeof(double))) == NULL ||
+		(s->ys = malloc(p->height * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (coordinates)");
+		exit(EXIT_FAILURE);
+	}
+
+	if (s->colour == HIST) {
+		if (p->maxIter < 65536) {
+			s->iter16 = malloc(numPixels * sizeof(uint16_t));
+		}
+		else {
+			s->iter32 = malloc(numPixels * sizeof(int));
+		}
+		if (s->iter16 == NULL && s->iter32 == NULL) {
+			perror("Cannot allocate memory (iterations)");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if ((s->histogram = calloc(p->maxIter, sizeof(long long))) == NULL ||
+		(s->table = malloc(p->maxIter * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((s->rgb = malloc(s->window * sizeof(unsigned char *))) == NULL ||
+		(s->ready = calloc(s->window, sizeof(int))) == NULL) {
+		perror("Cannot allocate memory (bands)");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < s->window; i++) {
+		if ((s->rgb[i] = malloc((size_t)BAND_ROWS * p->width * 3)) == NULL) {
+			perror("Cannot allocate memory (bands)");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// same grid as initialise in the other variants, so c matches carray exactly
+	x = p->xMin;
+	for (j = 0; j < p->width; j++) {
+		s->xs[j] = x;
+		x += p->step;
+	}
+	gridRows(p->yMax, p->step, p->height, s->ys);
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+}
+
+// iterate a single point, returns the same count as mandelCompute
+int mandelPixel(double complex c, int maxIter)
+{
+	double complex z = 0 + 0 * I;
+	int k;
+
+	for (k = 0; k < maxIter; k++) {
+		z = z * z + c;
+		if (cabs(z) > 2.0) {
+			return k;  // Not in Mandelbrot set
+		}
+	}
+	return maxIter - 1;  // In Mandelbrot set
+}
+
+// compute one band into the compact iteration buffer
+void computeBand(Stream *s, int band, long long *histogram)
+{
+	Parameters *p = s->p;
+	int i, j, k;
+	int end = (band + 1) * BAND_ROWS < p->height ? (band + 1) * BAND_ROWS : p->height;
+	size_t idx;
+
+	for (i = band * BAND_ROWS; i < end; i++) {
+		for (j = 0; j < p->width; j++) {
+			k = mandelPixel(s->xs[j] + s->ys[i] * I, p->maxIter);
+			idx = (size_t)i * p->width + j;
+			if (s->iter16 != NULL) {
+				s->iter16[idx] = (uint16_t)k;
+			}
+			else {
+				s->iter32[idx] = k;
+			}
+			histogram[k]++;
+		}
+	}
+}
+
+// colour one band straight to 8-bit RGB
+void colourBand(Stream *s, int band, unsigned char *rgb)
+{
+	Parameters *p = s->p;
+	int i, j, k;
+	int end = (band + 1) * BAND_ROWS < p->height ? (band + 1) * BAND_ROWS : p->height;
+	size_t idx;
+	double value;
+
+	for (i = band * BAND_ROWS; i < end; i++) {
+		for (j = 0; j < p->width; j++) {
+			if (s->colour == ESCAPE) {
+				k = mandelPixel(s->xs[j] + s->ys[i] * I, p->maxIter);
+				value = k == p->maxIter - 1 ? 0.0 : log(k + 1) / log(p->maxIter);
+			}
+			else {
+				idx = (size_t)i * p->width + j;
+				k = s->iter16 != NULL ? s->iter16[idx] : s->iter32[idx];
+				value = s->table[k];
+			}
+			paletteRGB(value, &rgb[((size_t)(i - band * BAND_ROWS) * p->width + j) * 3]);
+		}
+	}
+}
+
+// hand out bands until none are left, in the colour phase a band is only
+// taken once its slot in the ring has been written out
+void *doWork(void *arg)
+{
+	Stream *s = (Stream *)arg;
+	long long *histogram = NULL;
+	int band, slot, k;
+
+	if (s->phase == COMPUTE && (histogram = calloc(s->p->maxIter, sizeof(long long))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		if (s->phase == COLOUR) {
+			while (s->nextBand < s->numBands && s->nextBand >= s->nextWrite + s->window) {
+				pthread_cond_wait(&s->cond, &s->lock);
+			}
+		}
+		band = s->nextBand++;
+		pthread_mutex_unlock(&s->lock);
+
+		if (band >= s->numBands) {
+			break;
+		}
+
+		if (s->phase == COMPUTE) {
+			computeBand(s, band, histogram);
+		}
+		else {
+			slot = band % s->window;
+			colourBand(s, band, s->rgb[slot]);
+			pthread_mutex_lock(&s->lock);
+			s->ready[slot] = 1;
+			pthread_cond_broadcast(&s->cond);
+			pthread_mutex_unlock(&s->lock);
+		}
+	}
+
+	if (histogram != NULL) {
+		pthread_mutex_lock(&s->lock);
+		for (k = 0; k < s->p->maxIter; k++) {
+			s->histogram[k] += histogram[k];
+		}
+		pthread_mutex_unlock(&s->lock);
+		free(histogram);
+	}
+	return(NULL);
+}
+
+// main thread is the writer, bands go out in order as soon as each one is ready
+void writeBands(Stream *s, FILE *fp)
+{
+	Parameters *p = s->p;
+	int band, slot, rows;
+
+	for (band = 0; band < s->numBands; band++) {
+		slot = band % s->window;
+		pthread_mutex_lock(&s->lock);
+		while (!s->ready[slot]) {
+			pthread_cond_wait(&s->cond, &s->lock);
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		rows = (band + 1) * BAND_ROWS < p->height ? BAND_ROWS : p->height - band * BAND_ROWS;
+		if (fwrite(s->rgb[slot], 3, (size_t)rows * p->width, fp) != (size_t)rows * p->width) {
+			perror("Cannot write mandel.ppm file");
+			exit(EXIT_FAILURE);
+		}
+
+		pthread_mutex_lock(&s->lock);
+		s->ready[slot] = 0;
+		s->nextWrite = band + 1;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+// run one phase across numProcess threads, the caller writes while they work
+void streamCompute(Stream *s, FILE *fp)
+{
+	Parameters *p = s->p;
+	pthread_t *thr;
+	int i;
+
+	if ((thr = malloc(p->numProcess * sizeof(pthread_t))) == NULL) {
+		perror("Cannot allocate memory (threads)");
+		exit(EXIT_FAILURE);
+	}
+
+	if (s->colour == HIST) {
+		s->phase = COMPUTE;
+		s->nextBand = 0;
+		for (i = 0; i < p->numProcess; i++) {
+			pthread_create(&thr[i], NULL, doWork, (void *)s);
+		}
+		for (i = 0; i < p->numProcess; i++) {
+			pthread_join(thr[i], NULL);
+		}
+		printf("Compute finished, colouring %d bands\n", s->numBands);
+		histogramTable(s->histogram, p->maxIter, s->table);
+	}
+
+	s->phase = COLOUR;
+	s->nextBand = 0;
+	s->nextWrite = 0;
+	for (i = 0; i < p->numProcess; i++) {
+		pthread_create(&thr[i], NULL, doWork, (void *)s);
+	}
+	writeBands(s, fp);
+	for (i = 0; i < p->numProcess; i++) {
+		pthread_join(thr[i], NULL);
+	}
+	printf("Threads Joined\n");
+	free(thr);
+}
+
+// free all dynamic memory in the Stream structure
+void freeMemory(Stream *s)
+{
+	int i;
+
+	printf("	-> Freeing Memory <-\n");
+	for (i = 0; i < s->window; i++) {
+		free(s->rgb[i]);
+	}
+	free(s->rgb);
+	free(s->ready);
+	free(s->xs);
+	free(s->ys);
+	free(s->iter16);
+	free(s->iter32);
+	free(s->histogram);
+	free(s->table);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+}
@@ -33,6 +33,8 @@ typedef struct{
 	int start, end, chunksize;
 } Index;
 
+Arena arena;  // backing store for pixels, carray, iterations and histogram
+
 /* main program – execution begins here */
 int main(int argc, char *argv[])
 {
@@ -73,6 +75,7 @@ int main(int argc, char *argv[])
 
 	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
 	
+	affinityInit();
 	initialise(&p);
 	parrmandelCompute(&p);
 	histogramColouring(&p);
@@ -87,10 +90,7 @@ void freeMemory(Parameters p)
 {
 	//freeMemory_lib(p);
 	printf("	-> Freeing Memory <-\n");
-	free(p.pixels);
-	free(p.carray);
-	free(p.iterations);
-	free(p.histogram);
+	arenaFree(&arena);
 }
 
 // write coordinates and values to file for gnuplot
@@ -98,23 +98,7 @@ void writeToFile(Parameters p)
 {
 	//writeToFile_lib(p);
 	printf("	-> Using custom writeToFile <-\n");
-	FILE *fp;
-	double complex c;
-	
-	//Attempt to open the file
-	if((fp = fopen("mandel.dat", "w")) == NULL){
-		perror("Cannot open mandel.dat file");
-		exit(EXIT_FAILURE);
-	}
-
-	for(int i=0; i < p.height; i++){
-		for(int j=0; j < p.width; j++){
-			c = p.carray[i * p.width + j];
-			fprintf(fp, "%.12lf %.12lf %.12lf\n", creal(c), cimag(c), p.pixels[i*p.width + j]);
-		}
-		fprintf(fp, "\n");
-	}
-	fclose(fp);
+	writeDat(p, "mandel.dat");
 }
 
 // compute the colour for each pixel using histogram algorithm
@@ -152,6 +136,14 @@ void mandelCompute(Parameters *p)
 void parrmandelCompute(Parameters *p){
 
 	int sv[2], num;
+	char *shared = getenv("MANDEL_SHARED");
+
+	// MANDEL_SHARED=1 (memfd) or =/name (shm_open, mbworker can join): no copies, no messages
+	if (shared != NULL) {
+		sharedCompute(p, shared[0] == '/' ? shared : NULL);
+		return;
+	}
+
 	if(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) != 0){
 		perror("Socket error\n");
 	}else{
@@ -165,6 +157,7 @@ void parrmandelCompute(Parameters *p){
 	for(int i = 0; i < p->numProcess; i++){
 		if(fork() == 0){
 			//Child Process
+			pinWorker(i); //Its iterations pages are copied on first write, so they land on this CPU's node
 			read(sv[CHILD], &idx, sizeof(Index));
 			p->carray = &(p->carray[idx.start * p->width]);
 			p->height = idx.chunksize;
@@ -201,25 +194,7 @@ void initialise(Parameters *p)
 
 	p->step = (p->yMax - p->yMin) / p->width;
 	
-	if ((p->pixels = malloc(p->width * p->height * sizeof(double))) == NULL) {
-		perror("Cannot allocate memory (pixels)");
-		exit(EXIT_FAILURE);
-	}
-	
-	if ((p->carray = malloc(p->width * p->height * sizeof(double complex))) == NULL) {
-		perror("Cannot allocate memory (pixels)");
-		exit(EXIT_FAILURE);
-	}
-	
-	if ((p->iterations = malloc(p->width * p->height * sizeof(int))) == NULL) {
-		perror("Cannot allocate memory (iterations)");
-		exit(EXIT_FAILURE);
-	}
-	
-	if ((p->histogram = malloc(p->maxIter * sizeof(int))) == NULL) {
-		perror("Cannot allocate memory (histogram)");
-		exit(EXIT_FAILURE);
-	}
+	arenaAlloc(&arena, p, ARENA_ALL);
 	
 	// initialise array with zeros
 	for (i = 0; i < p->height; i++) {
@@ -229,14 +204,13 @@ void initialise(Parameters *p)
 	}
 	
 	// initialise carray with real/imaginary values for c
-	y = p->yMax;
 	for (i = 0; i < p->height; i++) {
+		y = gridY(p->yMax, p->step, i);
 		x = p->xMin;
 		for (j = 0; j < p->width; j++) {
 			p->carray[i * p->width + j] = x + y * I;
 			x += p->step;
 		}
-		y -= p->step;
 	}
 	
 	for (i = 0; i < p->maxIter; i++) {
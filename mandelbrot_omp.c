@@ -1,5 +1,37 @@
+// Mandelbrot set Generation
+// Parallelised using OpenMP over 2D tiles
+// The schedule is picked with MANDEL_SCHEDULE (dynamic, guided, static or tasks,
+// default dynamic) and the tile edge with MANDEL_TILE (default 64). "tasks"
+// recursively splits the frame into quadrants as OpenMP tasks down to one tile.
+// MANDEL_AFFINITY pins the threads (see mandel_affinity.c), buffers are
+// first-touched in parallel, each thread the band of tile rows it computes first.
+// Inside a tile each row is iterated LANES columns at a time with omp simd.
+// Rows mirrored about the real axis are skipped and copied (see mandel_symmetry.c).
+// MANDEL_FRACTAL picks the formula: mandelbrot (default), multibrot3..6,
+// burningship, tricorn, or julia[-multibrot3|4|-burningship|-tricorn][:re,im].
+// MANDEL_DISTANCE=1 shades by exterior distance estimate instead of the
+// histogram and also writes the distances to mandel.dist.
+// MANDEL_CHECKPOINT=file saves finished tiles every MANDEL_CHECKPOINT_INTERVAL
+// seconds (default 60, longer if saving is slow); a rerun with the same
+// parameters resumes from it.
+// Views whose step is too fine for double (below DD_STEP of the largest
+// coordinate) switch to double-double kernels automatically; MANDEL_PRECISION
+// (auto, double or dd) overrides the choice.
+// MANDEL_PREDICT=1 computes plain mandelbrot tiles through mandelPredict
+// (see mandel_predict.c) and reports its mispredictions.
+// MANDEL_SAVE_ITER=file saves the counts (and distances) for mbrecolour.
+// MANDEL_PERF=1 reads perf_event_open counters (see mandel_perf.c) for each
+// stage on the main thread and for each worker during mandelCompute.
+// "mbomp tune [maxIter]" probes the machine, times calibration renders over
+// tile sizes, thread counts and schedules, and writes the fastest to
+// mandel.profile (or MANDEL_PROFILE), which later runs load before the
+// environment overrides. A numThreads of 0 takes the profile's thread count.
+
+// Example coordinates: MANDEL_SCHEDULE=guided mbomp 10000 -0.668 0.32 0.02 6
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <complex.h>
 #include <time.h>
@@ -7,20 +39,92 @@
 #include <unistd.h>
 #include <omp.h>
 
+#define TILE_SIZE 64	// default tile edge in pixels
+#define LANES 8	// columns iterated together by the simd kernel
+#define DE_RADIUS2 1e6	// |z|^2 at which the distance estimate is taken
+#define DE_SCALE 64.0	// distance in pixels that shades to white
+#define CHECKPOINT_INTERVAL 60.0	// default seconds between checkpoints
+#define CHECKPOINT_BUSY 4	// the next save waits at least this many times as long as the last one took
+#define PROFILE "mandel.profile"	// default tuning profile
+#define TUNE_ITER 1000	// default maxIter of the calibration renders
+#define TUNE_SIZE 320	// calibration renders are TUNE_SIZE square
+#define TUNE_REPEATS 3	// best of this many timings per view
+#define FLOPS_PER_ITER 10	// z * z + c and |z|^2 in the plain mandelbrot kernel
+#define PEAK_PIPES 2	// vector FP instructions issued per cycle, for the peak
+#define DD_STEP 0x1p-42	// relative step below which double-double kernels take over
+#define DD_LIMIT 0x1p-96	// relative step at which double-double runs out too
+
 /* function prototypes */
 void initialise(Parameters *);
 void mandelCompute(Parameters *);
 void writeToFile(Parameters);
 void histogramColouring(Parameters *p);
 void freeMemory(Parameters p);
+void mandelTile(Parameters *p, int x0, int y0, int w, int h);
+void subdivide(Parameters *p, int x0, int y0, int w, int h);
+void mandelTiles(Parameters *p);
+void selectFractal(const char *spec);
+void mandelLanes(Parameters *p, int i, int j, int n);
+void distanceColouring(Parameters *p);
+void writeDistance(Parameters p);
+void tileDone(Parameters *p, int t);
+void runSchedule(Parameters *p);
+void perfWorkers(Parameters *p, int begin);
+int loadProfile(void);
+void tune(int maxIter);
+void ddParse(const char *s, double *hi, double *lo);
+void stageDone(const char *stage, PerfCounters *c);
+static int simdWidth(const char **name);
+int ddView(Parameters *p, const char *x, const char *y, double size);
+
+typedef struct {
+	const char *name;
+	void (*kernel)(Parameters *p, int i, int j, int n);  // iterate up to LANES pixels of a row
+	void (*distanceKernel)(Parameters *p, int i, int j, int n);  // same, also estimating distance, or NULL
+	void (*ddKernel)(Parameters *p, int i, int j, int n);  // same in double-double arithmetic, or NULL
+	int symmetric;  // same counts for conjugate c
+} Fractal;
+
+char schedule[16] = "dynamic";
+int tileSize = TILE_SIZE;
+int *mirror = NULL;  // symmetry plan for the frame being computed
+extern Fractal fractals[];
+Fractal *fractal = &fractals[0];  // formula picked with MANDEL_FRACTAL
+double juliaRe = -0.8, juliaIm = 0.156;  // fixed c of the Julia variants
+double *distance = NULL;  // exterior distance estimate of each pixel, with MANDEL_DISTANCE=1
+char *checkpoint = NULL;  // checkpoint file, with MANDEL_CHECKPOINT
+double checkpointInterval = CHECKPOINT_INTERVAL;
+double lastCheckpoint;  // time the last save finished
+double checkpointWait;  // seconds until the next save is due
+int checkpointSaving = 0;  // a thread is writing the checkpoint
+unsigned char *tilesDone = NULL;  // finished tiles, while checkpointing
+unsigned char *tilesSaved = NULL;  // the copy of tilesDone being saved
+CheckpointHeader header;  // identifies this render in the checkpoint file
+int predict = 0;  // MANDEL_PREDICT=1
+PredictStats predictStats;  // summed over tiles
+int perf = 0;  // MANDEL_PERF=1
+long long perfIterations;  // iterations of the pixels computed, for the rates
+
+Arena arena;  // backing store for pixels, carray, iterations and histogram
+WorkBand *bands = NULL;  // tile rows each thread first-touched and computes first
 
 /* main program – execution begins here */
 int main(int argc, char *argv[])
 {
-	int maxIter, numProcess;
-	double xc, yc, size;
+	int maxIter, numProcess = 0, profileThreads;
+	double xc, yc, size, start;
+	char *env;
 	Parameters p;
+	PerfCounters stage;
 	
+	p.xMinLo = p.yMaxLo = 0.0;
+	p.clo = NULL;
+	if (argc >= 2 && strcmp(argv[1], "tune") == 0) {
+		tune(argc >= 3 ? atoi(argv[2]) : TUNE_ITER);
+		return (0);
+	}
+	profileThreads = loadProfile();
+
 	if (argc < 2) {
 		printf("Usage: mandelbrot maxIter [x y size]\n\nUsing default values\n");
 		maxIter = 5000;
@@ -50,14 +154,92 @@ int main(int argc, char *argv[])
 	p.maxIter = maxIter;
 	p.height = HEIGHT;
 	p.width = WIDTH;
-	p.numProcess = numProcess;
+	p.numProcess = numProcess > 0 ? numProcess : profileThreads > 0 ? profileThreads : omp_get_max_threads();
+	p.step = (p.yMax - p.yMin) / p.width;
+
+	if ((env = getenv("MANDEL_SCHEDULE")) != NULL) {
+		snprintf(schedule, sizeof(schedule), "%s", env);
+	}
+	if ((env = getenv("MANDEL_TILE")) != NULL && atoi(env) > 0) {
+		tileSize = atoi(env);
+	}
+	if ((env = getenv("MANDEL_FRACTAL")) != NULL) {
+		selectFractal(env);
+	}
+	if ((env = getenv("MANDEL_CHECKPOINT")) != NULL && env[0] != '\0') {
+		checkpoint = env;
+		if ((env = getenv("MANDEL_CHECKPOINT_INTERVAL")) != NULL && atof(env) > 0) {
+			checkpointInterval = atof(env);
+		}
+		if (strcmp(schedule, "tasks") == 0) {
+			printf("Checkpointing needs a tile schedule, using dynamic\n");
+			snprintf(schedule, sizeof(schedule), "dynamic");
+		}
+	}
+	if ((env = getenv("MANDEL_DISTANCE")) != NULL && strcmp(env, "1") == 0) {
+		if (fractal->distanceKernel == NULL) {
+			fprintf(stderr, "No distance estimator for %s\n", fractal->name);
+			exit(EXIT_FAILURE);
+		}
+		if ((distance = malloc((size_t)p.width * p.height * sizeof(double))) == NULL) {
+			perror("Cannot allocate memory (distance)");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (argc == 6 && ddView(&p, argv[2], argv[3], size)) {
+		if ((p.clo = malloc((size_t)p.width * p.height * sizeof(double complex))) == NULL) {
+			perror("Cannot allocate memory (double-double carray)");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if ((env = getenv("MANDEL_PREDICT")) != NULL && strcmp(env, "1") == 0) {
+		if (fractal->kernel == mandelLanes && distance == NULL && p.clo == NULL) {
+			predict = 1;
+		}
+		else {
+			printf("Prediction only covers the plain double mandelbrot kernel, ignoring MANDEL_PREDICT\n");
+		}
+	}
 
 	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
+	printf("%d threads, %s schedule, %d pixel tiles\n", p.numProcess, schedule, tileSize);
+	if (fractal->kernel != mandelLanes) {
+		printf("Fractal %s, Julia c = %lf%+lfi\n", fractal->name, juliaRe, juliaIm);
+	}
 	
+	if ((env = getenv("MANDEL_PERF")) != NULL && strcmp(env, "1") == 0) {
+		perf = 1;
+		perfOpen(&stage);
+		perfStart(&stage);
+	}
+	
+	affinityInit();
 	initialise(&p);
+	stageDone("initialise", &stage);
+	start = omp_get_wtime();
 	mandelCompute(&p);
-	histogramColouring(&p);
+	printf("Time used for mandelCompute %f\n", omp_get_wtime() - start);
+	stageDone("compute-main", &stage);
+	if (predict) {
+		predictReport(&predictStats);
+	}
+	if ((env = getenv("MANDEL_SAVE_ITER")) != NULL) {
+		iterSave(&p, env, distance);
+	}
+	if (distance != NULL) {
+		distanceColouring(&p);
+		writeDistance(p);
+	}
+	else {
+		histogramColouring(&p);
+	}
+	stageDone("colouring", &stage);
 	writeToFile(p);
+	stageDone("write", &stage);
+	if (perf) {
+		perfClose(&stage);
+	}
 	freeMemory(p);
 	
 	return (0);
@@ -67,115 +249,947 @@ int main(int argc, char *argv[])
 void freeMemory(Parameters p)
 {
 	printf("	-> Freeing Memory <-\n");
-	free(p.pixels);
-	free(p.carray);
-	free(p.iterations);
-	free(p.histogram);
+	arenaFree(&arena);
+	free(bands);
+	bands = NULL;
+	free(distance);
+	free(p.clo);
 }
 
 // write coordinates and values to file for gnuplot
 void writeToFile(Parameters p)
 {
 	printf("	-> Using custom writeToFile <-\n");
+	writeDat(p, "mandel.dat");
+}
+
+// compute the colour for each pixel using histogram algorithm
+void histogramColouring(Parameters *p)
+{
+	histogramColouring_lib(p);
+}
+
+// shade by distance to the boundary in pixels, dark at the boundary and in the
+// set, so filaments stay visible however few iterations they took
+void distanceColouring(Parameters *p)
+{
+	int n;
+
+	#pragma omp parallel for num_threads(p->numProcess)
+	for (n = 0; n < p->width * p->height; n++) {
+		p->pixels[n] = pow(fmin(distance[n] / (p->step * DE_SCALE), 1.0), 0.25);
+	}
+}
+
+// raw distances in pixels as 32-bit floats after a "MDIST width height" line,
+// 0 inside the set; a distance below 1 marks a pixel worth supersampling
+void writeDistance(Parameters p)
+{
 	FILE *fp;
-	double complex c;
-	
-	//Attempt to open the file
-	if((fp = fopen("mandel.dat", "w")) == NULL){
-		perror("Cannot open mandel.dat file");
+	float *row;
+	int i, j;
+
+	if ((fp = fopen("mandel.dist", "wb")) == NULL) {
+		perror("Cannot open mandel.dist file");
 		exit(EXIT_FAILURE);
 	}
-
-	for(int i=0; i < p.height; i++){
-		for(int j=0; j < p.width; j++){
-			c = p.carray[i * p.width + j];
-			fprintf(fp, "%.12lf %.12lf %.12lf\n", creal(c), cimag(c), p.pixels[i*p.width + j]);
+	if ((row = malloc(p.width * sizeof(float))) == NULL) {
+		perror("Cannot allocate memory (distance row)");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "MDIST %d %d\n", p.width, p.height);
+	for (i = 0; i < p.height; i++) {
+		for (j = 0; j < p.width; j++) {
+			row[j] = distance[i * p.width + j] / p.step;
+		}
+		if (fwrite(row, sizeof(float), p.width, fp) != (size_t)p.width) {
+			perror("Cannot write mandel.dist file");
+			exit(EXIT_FAILURE);
 		}
-		fprintf(fp, "\n");
 	}
+	free(row);
 	fclose(fp);
 }
 
-// compute the colour for each pixel using histogram algorithm
-void histogramColouring(Parameters *p)
+// iterate n (<= LANES) consecutive pixels of row i starting at column j together
+// the escape test is |z|^2 > 4 rather than cabs(z) > 2 so the lanes vectorise,
+// escaped lanes keep iterating harmlessly until every lane is done
+// One kernel is generated per formula: START sets z0 and the constant a added
+// each step from the pixel's c, STEP computes the next x, y into xn, yn. Both
+// are pasted into the loop body, so the formula is fixed at compile time.
+#define LANE_KERNEL(name, START, STEP) \
+void name(Parameters *p, int i, int j, int n) \
+{ \
+	double cr[LANES], ci[LANES], ar[LANES], ai[LANES], x[LANES], y[LANES], xn, yn; \
+	int iter[LANES], done[LANES]; \
+	int k, l, active; \
+\
+	for (l = 0; l < LANES; l++) { \
+		/* pad a short run with its last pixel so every lane has a valid c */ \
+		cr[l] = creal(p->carray[i * p->width + j + (l < n ? l : n - 1)]); \
+		ci[l] = cimag(p->carray[i * p->width + j + (l < n ? l : n - 1)]); \
+		START; \
+		iter[l] = p->maxIter - 1; \
+		done[l] = 0; \
+	} \
+\
+	for (k = 0; k < p->maxIter; k++) { \
+		active = 0; \
+		_Pragma("omp simd private(xn, yn) reduction(+:active)") \
+		for (l = 0; l < LANES; l++) { \
+			STEP; \
+			x[l] = xn; \
+			y[l] = yn; \
+			iter[l] = (!done[l] && x[l] * x[l] + y[l] * y[l] > 4.0) ? k : iter[l]; \
+			done[l] = done[l] || x[l] * x[l] + y[l] * y[l] > 4.0; \
+			active += !done[l]; \
+		} \
+		if (active == 0) { \
+			break; \
+		} \
+	} \
+\
+	for (l = 0; l < n; l++) { \
+		p->iterations[i * p->width + j + l] = iter[l]; \
+	} \
+}
+
+// z0 = 0 and c from the pixel, or z0 from the pixel and a fixed c for Julia sets
+#define PIXEL_C x[l] = y[l] = 0.0; ar[l] = cr[l]; ai[l] = ci[l]
+#define PIXEL_Z x[l] = cr[l]; y[l] = ci[l]; ar[l] = juliaRe; ai[l] = juliaIm
+
+// z * z + a with the same operations as the complex multiply
+#define SQUARE \
+	xn = (x[l] * x[l] - y[l] * y[l]) + ar[l]; \
+	yn = (x[l] * y[l] + y[l] * x[l]) + ai[l]
+
+// z^POWER + a by repeated multiplication, the constant trip count unrolls
+#define POWER_OF(POWER) \
+	double px = x[l], py = y[l], t; \
+	for (int e = 1; e < POWER; e++) { \
+		t = px * x[l] - py * y[l]; \
+		py = px * y[l] + py * x[l]; \
+		px = t; \
+	} \
+	xn = px + ar[l]; \
+	yn = py + ai[l]
+
+// (|x| + i|y|)^2 + a
+#define BURNING_SHIP \
+	xn = (x[l] * x[l] - y[l] * y[l]) + ar[l]; \
+	yn = fabs(x[l] * y[l] + y[l] * x[l]) + ai[l]
+
+// conj(z)^2 + a
+#define TRICORN \
+	xn = (x[l] * x[l] - y[l] * y[l]) + ar[l]; \
+	yn = -(x[l] * y[l] + y[l] * x[l]) + ai[l]
+
+// Distance estimation carries dz alongside z (dz/dc from 0, or dz/dz0 from 1
+// for Julia sets) and takes |z| ln|z| / |dz| once |z|^2 passes DE_RADIUS2, a few
+// iterations after the count is recorded at |z| = 2, so counts are unchanged.
+// Lanes snapshot z and dz until they are far out, then only ride along.
+#define DISTANCE_KERNEL(name, START, DSTART, DPLUS) \
+void name(Parameters *p, int i, int j, int n) \
+{ \
+	double cr[LANES], ci[LANES], ar[LANES], ai[LANES], x[LANES], y[LANES], dx[LANES], dy[LANES]; \
+	double fx[LANES], fy[LANES], fdx[LANES], fdy[LANES], xn, yn, dxn, r2; \
+	int iter[LANES], done[LANES], far[LANES]; \
+	int k, l, active; \
+\
+	for (l = 0; l < LANES; l++) { \
+		cr[l] = creal(p->carray[i * p->width + j + (l < n ? l : n - 1)]); \
+		ci[l] = cimag(p->carray[i * p->width + j + (l < n ? l : n - 1)]); \
+		START; \
+		DSTART; \
+		fx[l] = fy[l] = fdx[l] = fdy[l] = 0.0; \
+		iter[l] = p->maxIter - 1; \
+		done[l] = far[l] = 0; \
+	} \
+\
+	for (k = 0; k < p->maxIter; k++) { \
+		active = 0; \
+		_Pragma("omp simd private(xn, yn, dxn, r2) reduction(+:active)") \
+		for (l = 0; l < LANES; l++) { \
+			dxn = 2.0 * (x[l] * dx[l] - y[l] * dy[l]) + DPLUS; \
+			dy[l] = 2.0 * (x[l] * dy[l] + y[l] * dx[l]); \
+			dx[l] = dxn; \
+			SQUARE; \
+			x[l] = xn; \
+			y[l] = yn; \
+			r2 = x[l] * x[l] + y[l] * y[l]; \
+			iter[l] = (!done[l] && r2 > 4.0) ? k : iter[l]; \
+			done[l] = done[l] || r2 > 4.0; \
+			fx[l] = (done[l] && !far[l]) ? x[l] : fx[l]; \
+			fy[l] = (done[l] && !far[l]) ? y[l] : fy[l]; \
+			fdx[l] = (done[l] && !far[l]) ? dx[l] : fdx[l]; \
+			fdy[l] = (done[l] && !far[l]) ? dy[l] : fdy[l]; \
+			far[l] = far[l] || r2 > DE_RADIUS2; \
+			active += !far[l]; \
+		} \
+		if (active == 0) { \
+			break; \
+		} \
+	} \
+\
+	for (l = 0; l < n; l++) { \
+		p->iterations[i * p->width + j + l] = iter[l]; \
+		r2 = fx[l] * fx[l] + fy[l] * fy[l]; \
+		distance[i * p->width + j + l] = done[l] ? 0.5 * log(r2) * sqrt(r2) / hypot(fdx[l], fdy[l]) : 0.0; \
+	} \
+}
+
+LANE_KERNEL(mandelLanes, PIXEL_C, SQUARE)
+LANE_KERNEL(multibrot3Lanes, PIXEL_C, POWER_OF(3))
+LANE_KERNEL(multibrot4Lanes, PIXEL_C, POWER_OF(4))
+LANE_KERNEL(multibrot5Lanes, PIXEL_C, POWER_OF(5))
+LANE_KERNEL(multibrot6Lanes, PIXEL_C, POWER_OF(6))
+LANE_KERNEL(burningShipLanes, PIXEL_C, BURNING_SHIP)
+LANE_KERNEL(tricornLanes, PIXEL_C, TRICORN)
+LANE_KERNEL(juliaLanes, PIXEL_Z, SQUARE)
+LANE_KERNEL(juliaMultibrot3Lanes, PIXEL_Z, POWER_OF(3))
+LANE_KERNEL(juliaMultibrot4Lanes, PIXEL_Z, POWER_OF(4))
+LANE_KERNEL(juliaBurningShipLanes, PIXEL_Z, BURNING_SHIP)
+LANE_KERNEL(juliaTricornLanes, PIXEL_Z, TRICORN)
+DISTANCE_KERNEL(mandelDistanceLanes, PIXEL_C, dx[l] = dy[l] = 0.0, 1.0)
+DISTANCE_KERNEL(juliaDistanceLanes, PIXEL_Z, dx[l] = 1.0; dy[l] = 0.0, 0.0)
+
+// Double-double arithmetic: a value is the unevaluated sum hi + lo with |lo| at
+// most half an ulp of hi, about 106 bits. Products are split with Dekker's
+// algorithm rather than fma so the lanes vectorise on plain SSE2; this needs
+// a * b + c left uncontracted, as it is without -march flags.
+#define DD_SPLIT 134217729.0	// 2^27 + 1
+
+// s + e = a + b exactly
+#define TWO_SUM(s, e, a, b) \
+	s = (a) + (b); \
+	bb = s - (a); \
+	e = ((a) - (s - bb)) + ((b) - bb)
+
+// s + e = a + b exactly, given |a| >= |b|
+#define QUICK_TWO_SUM(s, e, a, b) \
+	s = (a) + (b); \
+	e = (b) - (s - (a))
+
+// s + e = a * b exactly
+#define TWO_PROD(s, e, a, b) \
+	s = (a) * (b); \
+	t = DD_SPLIT * (a); ah = t - (t - (a)); al = (a) - ah; \
+	t = DD_SPLIT * (b); bh = t - (t - (b)); bl = (b) - bh; \
+	e = ((ah * bh - s) + ah * bl + al * bh) + al * bl
+
+// (rh, rl) = (xh, xl) * (yh, yl)
+#define DD_MUL(rh, rl, xh, xl, yh, yl) \
+	TWO_PROD(ph, pe, xh, yh); \
+	pe += (xh) * (yl) + (xl) * (yh); \
+	QUICK_TWO_SUM(rh, rl, ph, pe)
+
+// (rh, rl) = (xh, xl) + (yh, yl), the error is relative to the operands, which
+// is all the iteration needs since |z| stays below 2 while it matters
+#define DD_ADD(rh, rl, xh, xl, yh, yl) \
+	TWO_SUM(ph, pe, xh, yh); \
+	pe += (xl) + (yl); \
+	QUICK_TWO_SUM(rh, rl, ph, pe)
+
+// z0 = 0 and c from the pixel, or z0 from the pixel and the Julia c
+#define DD_PIXEL_C xh[l] = xl[l] = yh[l] = yl[l] = 0.0; arh[l] = cr[l]; arl[l] = crl[l]; aih[l] = ci[l]; ail[l] = cil[l]
+#define DD_PIXEL_Z xh[l] = cr[l]; xl[l] = crl[l]; yh[l] = ci[l]; yl[l] = cil[l]; arh[l] = juliaRe; aih[l] = juliaIm; arl[l] = ail[l] = 0.0
+
+// LANE_KERNEL for z^2 + a in double-double, c = carray + clo
+#define DD_KERNEL(name, START) \
+void name(Parameters *p, int i, int j, int n) \
+{ \
+	double cr[LANES], ci[LANES], crl[LANES], cil[LANES], arh[LANES], arl[LANES], aih[LANES], ail[LANES]; \
+	double xh[LANES], xl[LANES], yh[LANES], yl[LANES]; \
+	int iter[LANES], done[LANES]; \
+	int k, l, m, active; \
+\
+	for (l = 0; l < LANES; l++) { \
+		m = i * p->width + j + (l < n ? l : n - 1); \
+		cr[l] = creal(p->carray[m]); \
+		ci[l] = cimag(p->carray[m]); \
+		crl[l] = creal(p->clo[m]); \
+		cil[l] = cimag(p->clo[m]); \
+		START; \
+		iter[l] = p->maxIter - 1; \
+		done[l] = 0; \
+	} \
+\
+	for (k = 0; k < p->maxIter; k++) { \
+		active = 0; \
+		_Pragma("omp simd reduction(+:active)") \
+		for (l = 0; l < LANES; l++) { \
+			double bb, t, ah, al, bh, bl, ph, pe, x2h, x2l, y2h, y2l, xyh, xyl, th, tl; \
+			DD_MUL(x2h, x2l, xh[l], xl[l], xh[l], xl[l]); \
+			DD_MUL(y2h, y2l, yh[l], yl[l], yh[l], yl[l]); \
+			DD_MUL(xyh, xyl, xh[l], xl[l], yh[l], yl[l]); \
+			DD_ADD(th, tl, x2h, x2l, -y2h, -y2l); \
+			DD_ADD(xh[l], xl[l], th, tl, arh[l], arl[l]); \
+			DD_ADD(yh[l], yl[l], 2.0 * xyh, 2.0 * xyl, aih[l], ail[l]); \
+			iter[l] = (!done[l] && xh[l] * xh[l] + yh[l] * yh[l] > 4.0) ? k : iter[l]; \
+			done[l] = done[l] || xh[l] * xh[l] + yh[l] * yh[l] > 4.0; \
+			active += !done[l]; \
+		} \
+		if (active == 0) { \
+			break; \
+		} \
+	} \
+\
+	for (l = 0; l < n; l++) { \
+		p->iterations[i * p->width + j + l] = iter[l]; \
+	} \
+}
+
+DD_KERNEL(mandelDDLanes, DD_PIXEL_C)
+DD_KERNEL(juliaDDLanes, DD_PIXEL_Z)
+
+// formulas selectable with MANDEL_FRACTAL, symmetric ones are mirror images
+// about the real axis so mandel_symmetry.c can skip rows
+Fractal fractals[] = {
+	{"mandelbrot", mandelLanes, mandelDistanceLanes, mandelDDLanes, 1},
+	{"multibrot3", multibrot3Lanes, NULL, NULL, 1},
+	{"multibrot4", multibrot4Lanes, NULL, NULL, 1},
+	{"multibrot5", multibrot5Lanes, NULL, NULL, 1},
+	{"multibrot6", multibrot6Lanes, NULL, NULL, 1},
+	{"burningship", burningShipLanes, NULL, NULL, 0},
+	{"tricorn", tricornLanes, NULL, NULL, 1},
+	{"julia", juliaLanes, juliaDistanceLanes, juliaDDLanes, 0},
+	{"julia-multibrot3", juliaMultibrot3Lanes, NULL, NULL, 0},
+	{"julia-multibrot4", juliaMultibrot4Lanes, NULL, NULL, 0},
+	{"julia-burningship", juliaBurningShipLanes, NULL, NULL, 0},
+	{"julia-tricorn", juliaTricornLanes, NULL, NULL, 0},
+	{NULL, NULL, NULL, NULL, 0}
+};
+
+// pick the formula from "name" or "name:re,im", the latter also setting the Julia c
+void selectFractal(const char *spec)
 {
-	histogramColouring_lib(p);
+	int length = strcspn(spec, ":");
+
+	for (fractal = fractals; fractal->name != NULL; fractal++) {
+		if (strncmp(fractal->name, spec, length) == 0 && fractal->name[length] == '\0') {
+			break;
+		}
+	}
+	if (fractal->name == NULL) {
+		fprintf(stderr, "Unknown fractal %s, choose one of:", spec);
+		for (fractal = fractals; fractal->name != NULL; fractal++) {
+			fprintf(stderr, " %s", fractal->name);
+		}
+		fprintf(stderr, "\n");
+		exit(EXIT_FAILURE);
+	}
+	if (spec[length] == ':' && sscanf(spec + length + 1, "%lf,%lf", &juliaRe, &juliaIm) != 2) {
+		fprintf(stderr, "Julia c must be given as re,im\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// compute one w x h tile with its top left corner at (x0, y0)
+void mandelTile(Parameters *p, int x0, int y0, int w, int h)
+{
+	PredictStats stats;
+	int i, j, n;
+
+	if (predict) {
+		// runs of rows that are not mirrored
+		memset(&stats, 0, sizeof(stats));
+		for (i = y0; i < y0 + h; i += n) {
+			for (n = 1; i + n < y0 + h && (mirror == NULL || mirror[i + n] < 0) == (mirror == NULL || mirror[i] < 0); n++);
+			if (mirror == NULL || mirror[i] < 0) {
+				mandelPredict(p, x0, i, w, n, &stats);
+			}
+		}
+		#pragma omp critical(predict)
+		predictAdd(&predictStats, &stats);
+		return;
+	}
+
+	for (i = y0; i < y0 + h; i++) {
+		if (mirror != NULL && mirror[i] >= 0) {
+			continue;
+		}
+		for (j = x0; j < x0 + w; j += LANES) {
+			(distance != NULL ? fractal->distanceKernel : p->clo != NULL ? fractal->ddKernel : fractal->kernel)(p, i, j, x0 + w - j < LANES ? x0 + w - j : LANES);
+		}
+	}
+}
+
+// split a region into quadrants as tasks until it is no bigger than a tile
+void subdivide(Parameters *p, int x0, int y0, int w, int h)
+{
+	int hw = w / 2, hh = h / 2;
+
+	if (w <= tileSize && h <= tileSize) {
+		mandelTile(p, x0, y0, w, h);
+		return;
+	}
+	if (w <= tileSize) {
+		#pragma omp task
+		subdivide(p, x0, y0, w, hh);
+		subdivide(p, x0, y0 + hh, w, h - hh);
+	}
+	else if (h <= tileSize) {
+		#pragma omp task
+		subdivide(p, x0, y0, hw, h);
+		subdivide(p, x0 + hw, y0, w - hw, h);
+	}
+	else {
+		#pragma omp task
+		subdivide(p, x0, y0, hw, hh);
+		#pragma omp task
+		subdivide(p, x0 + hw, y0, w - hw, hh);
+		#pragma omp task
+		subdivide(p, x0, y0 + hh, hw, h - hh);
+		subdivide(p, x0 + hw, y0 + hh, w - hw, h - hh);
+	}
+	#pragma omp taskwait
 }
 
 // test each point in the complex plane to see if it is in the set or not
 void mandelCompute(Parameters *p)
 {
-	//mandelCompute_lib(p);
 	printf("	-> Using custom mandelCompute <-\n");
-	double complex c, z;
-	int i,j ,k;
-
-    #pragma omp parallel for num_threads(p->numProcess) private(i, j, k, c, z) shared(p)
-	for(i=0; i < p->height; i++){
-		//printf("Hello from process: %d\n", omp_get_thread_num());
-		for(j=0; j < p->width; j++){
-			z = 0 + 0*I;
-			c = p->carray[i * p->width + j];
-			for(k=0; k < p->maxIter; k++){
-				z = z * z + c;
-				if(cabs(z) > 2.0){
-					p->iterations[i*p->width + j] = k;
-					break;
+	int rows = p->height;
+
+	// the symmetry plan follows the double grid, so double-double views compute every row
+	if (fractal->symmetric && p->clo == NULL) {
+		if ((mirror = malloc(p->height * sizeof(int))) == NULL) {
+			perror("Cannot allocate memory (symmetry)");
+			exit(EXIT_FAILURE);
+		}
+		rows = symmetryPlan(p, mirror);
+	}
+	printf("Computing %d of %d rows\n", rows, p->height);
+
+	if (perf) {
+		perfWorkers(p, 1);
+	}
+	runSchedule(p);
+	if (perf) {
+		perfWorkers(p, 0);
+	}
+
+	if (mirror != NULL) {
+		symmetryCopy(p, mirror);
+		for (int i = 0; i < p->height && distance != NULL; i++) {
+			if (mirror[i] >= 0) {
+				memcpy(&distance[i * p->width], &distance[mirror[i] * p->width], p->width * sizeof(double));
+			}
+		}
+		free(mirror);
+		mirror = NULL;
+	}
+}
+
+// open and start the counters of every thread in the team, or stop them and
+// report per worker and in total; a thread keeps its counters between the
+// parallel regions because libgomp reuses the same threads for the same team
+void perfWorkers(Parameters *p, int begin)
+{
+	static PerfCounters *workers;
+	PerfCounters total;
+	const char *simd;
+	char name[32];
+	double flops = fractal->kernel == mandelLanes && distance == NULL && p->clo == NULL ? FLOPS_PER_ITER : 0.0;
+	int i, j, t;
+
+	if (begin) {
+		if ((workers = malloc(p->numProcess * sizeof(PerfCounters))) == NULL) {
+			perror("Cannot allocate memory (counters)");
+			exit(EXIT_FAILURE);
+		}
+		#pragma omp parallel num_threads(p->numProcess)
+		{
+			perfOpen(&workers[omp_get_thread_num()]);
+			perfStart(&workers[omp_get_thread_num()]);
+		}
+		return;
+	}
+
+	#pragma omp parallel num_threads(p->numProcess)
+	{
+		perfStop(&workers[omp_get_thread_num()]);
+		perfClose(&workers[omp_get_thread_num()]);
+	}
+
+	// iterations of the pixels computed, mirrored rows are copied
+	perfIterations = 0;
+	for (i = 0; i < p->height; i++) {
+		for (j = 0; j < p->width && (mirror == NULL || mirror[i] < 0); j++) {
+			perfIterations += p->iterations[i * p->width + j] + 1;
+		}
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (t = 0; t < p->numProcess; t++) {
+		snprintf(name, sizeof(name), "worker-%d", t);
+		perfReport(name, &workers[t], 0, 0.0, 0.0);
+		perfAdd(&total, &workers[t]);
+	}
+	perfReport("compute", &total, perfIterations, flops, (double)simdWidth(&simd) * PEAK_PIPES);
+	free(workers);
+}
+
+// compute the frame with the current schedule
+void runSchedule(Parameters *p)
+{
+	if (strcmp(schedule, "tasks") == 0) {
+		#pragma omp parallel num_threads(p->numProcess)
+		#pragma omp single
+		subdivide(p, 0, 0, p->width, p->height);
+	}
+	else {
+		mandelTiles(p);
+	}
+}
+
+// hand the tiles out with the schedule picked by MANDEL_SCHEDULE, skipping
+// tiles a checkpoint says are already done
+void mandelTiles(Parameters *p)
+{
+	int k, tilesAcross, numTiles, finished = 0, chunk, stealing;
+
+	// static keeps each thread to the band it first-touched, dynamic takes
+	// single tiles and guided halves of a band, both its own band first
+	chunk = strcmp(schedule, "guided") == 0 ? 0 : 1;
+	stealing = strcmp(schedule, "static") != 0;
+
+	tilesAcross = (p->width + tileSize - 1) / tileSize;
+	numTiles = tilesAcross * ((p->height + tileSize - 1) / tileSize);
+
+	if (checkpoint != NULL) {
+		if ((tilesDone = calloc(numTiles, 1)) == NULL || (tilesSaved = malloc(numTiles)) == NULL) {
+			perror("Cannot allocate memory (checkpoint)");
+			exit(EXIT_FAILURE);
+		}
+		checkpointHeader(&header, p, tileSize, numTiles, fractal->name, juliaRe, juliaIm, distance != NULL);
+		if ((finished = checkpointLoad(checkpoint, &header, tilesDone, p, distance)) > 0) {
+			printf("Resuming from %s, %d of %d tiles done\n", checkpoint, finished, numTiles);
+		}
+		lastCheckpoint = omp_get_wtime();
+		checkpointWait = checkpointInterval;
+	}
+
+	for (k = 0; k < p->numProcess; k++) {
+		bands[k].next = bands[k].first;
+	}
+	#pragma omp parallel num_threads(p->numProcess)
+	{
+		int own = omp_get_thread_num(), first, count, t, steal;
+
+		// a smaller team than asked for leaves bands without an owner
+		steal = stealing || omp_get_num_threads() < p->numProcess;
+		while ((first = steal ? bandClaim(bands, p->numProcess, own, chunk, &count) : bandClaim(&bands[own], 1, 0, chunk, &count)) >= 0) {
+			for (t = first; t < first + count; t++) {
+				int x0 = (t % tilesAcross) * tileSize;
+				int y0 = (t / tilesAcross) * tileSize;
+				if (tilesDone != NULL && tilesDone[t]) {
+					continue;
 				}
+				mandelTile(p, x0, y0,
+					x0 + tileSize < p->width ? tileSize : p->width - x0,
+					y0 + tileSize < p->height ? tileSize : p->height - y0);
+				if (tilesDone != NULL) {
+					tileDone(p, t);
+				}
+			}
+		}
+	}
+
+	if (checkpoint != NULL) {
+		// the render is complete, a later run should start afresh
+		unlink(checkpoint);
+		free(tilesDone);
+		free(tilesSaved);
+		tilesDone = NULL;
+		tilesSaved = NULL;
+	}
+}
+
+// mark tile t finished and save a checkpoint if the interval has passed. The
+// critical section only copies tilesDone, which also orders the tiles' results
+// before the save reads them; the thread that took the copy writes it outside
+// the lock while the others go on, and no other save starts until it is done
+void tileDone(Parameters *p, int t)
+{
+	double start, end;
+	int save = 0;
+
+	#pragma omp critical(checkpoint)
+	{
+		tilesDone[t] = 1;
+		if (!checkpointSaving && omp_get_wtime() - lastCheckpoint >= checkpointWait) {
+			memcpy(tilesSaved, tilesDone, header.numTiles);
+			checkpointSaving = 1;
+			save = 1;
+		}
+	}
+	if (save) {
+		start = omp_get_wtime();
+		checkpointSave(checkpoint, &header, tilesSaved, p, distance);
+		end = omp_get_wtime();
+		#pragma omp critical(checkpoint)
+		{
+			lastCheckpoint = end;
+			checkpointWait = (end - start) * CHECKPOINT_BUSY > checkpointInterval ? (end - start) * CHECKPOINT_BUSY : checkpointInterval;
+			checkpointSaving = 0;
+		}
+	}
+}
+
+// set schedule and tile size from the tuning profile if there is one,
+// returns its thread count or 0
+int loadProfile(void)
+{
+	char *path = getenv("MANDEL_PROFILE"), line[256], key[32], value[16];
+	int threads = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path != NULL ? path : PROFILE, "r")) == NULL) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%31s %15s", key, value) != 2) {
+			continue;
+		}
+		if (strcmp(key, "threads") == 0) {
+			threads = atoi(value);
+		}
+		else if (strcmp(key, "schedule") == 0) {
+			snprintf(schedule, sizeof(schedule), "%s", value);
+		}
+		else if (strcmp(key, "tile") == 0 && atoi(value) > 0) {
+			tileSize = atoi(value);
+		}
+	}
+	fclose(fp);
+	printf("Loaded profile %s\n", path != NULL ? path : PROFILE);
+	return threads;
+}
+
+// size in bytes of the level-th data or unified cache of cpu0, 0 if unknown
+static long cacheSize(int level)
+{
+	char path[96], type[32];
+	long size = 0, found;
+	int index, cacheLevel;
+	char unit;
+	FILE *fp;
+
+	for (index = 0; index < 8; index++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+		if ((fp = fopen(path, "r")) == NULL) {
+			break;
+		}
+		cacheLevel = fscanf(fp, "%d", &cacheLevel) == 1 ? cacheLevel : 0;
+		fclose(fp);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+		if ((fp = fopen(path, "r")) == NULL || fscanf(fp, "%31s", type) != 1) {
+			if (fp != NULL) {
+				fclose(fp);
 			}
-			if(k >= p->maxIter){
-				p->iterations[i * p->width + j] = p->maxIter - 1;
+			continue;
+		}
+		fclose(fp);
+		if (cacheLevel != level || strcmp(type, "Instruction") == 0) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+		if ((fp = fopen(path, "r")) != NULL) {
+			unit = 'B';
+			if (fscanf(fp, "%ld%c", &found, &unit) >= 1) {
+				size = found * (unit == 'K' ? 1024 : unit == 'M' ? 1024 * 1024 : 1);
 			}
-		}			
+			fclose(fp);
+		}
 	}
+	return size;
 }
 
+// widest double vector the CPU supports, in lanes
+static int simdWidth(const char **name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		*name = "avx512";
+		return 8;
+	}
+	if (__builtin_cpu_supports("avx")) {
+		*name = "avx";
+		return 4;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		*name = "sse2";
+		return 2;
+	}
+#endif
+	*name = "scalar";
+	return 1;
+}
+
+// time calibration renders over tile sizes, thread counts and schedules and
+// write the fastest combination to the profile
+void tune(int maxIter)
+{
+	static const char *schedules[] = {"static", "dynamic", "guided", "tasks"};
+	static const int tiles[] = {16, 32, 64, 128};
+	static const double views[][3] = {{-0.75, 0.0, 3.0}, {-0.668, 0.32, 0.02}};  // overview, seahorse
+	int cpus = omp_get_num_procs(), threads[3], candidates[3], numThreads = 0;
+	int s, t, n, v, r, bestThreads = 1, bestTile = TILE_SIZE, lanes;
+	long l1 = cacheSize(1), l2 = cacheSize(2), l3 = cacheSize(3);
+	double total, best = -1.0, elapsed, fastest, start;
+	char bestSchedule[16] = "dynamic", *path = getenv("MANDEL_PROFILE");
+	const char *simd;
+	Parameters p;
+	FILE *fp;
+
+	p.clo = NULL;
+	lanes = simdWidth(&simd);
+	printf("%d CPUs, L1d %ldK, L2 %ldK, L3 %ldK, %s (%d doubles per vector)\n", cpus, l1 / 1024, l2 / 1024, l3 / 1024, simd, lanes);
+
+	// half the CPUs (one per core with SMT), all of them, and oversubscribed;
+	// listed explicitly since doubling from cpus / 2 misses an odd cpus
+	candidates[0] = cpus > 1 ? cpus / 2 : 1;
+	candidates[1] = cpus;
+	candidates[2] = 2 * cpus;
+	for (n = 0; n < 3; n++) {
+		if (numThreads == 0 || threads[numThreads - 1] != candidates[n]) {
+			threads[numThreads++] = candidates[n];
+		}
+	}
+
+	p.width = p.height = TUNE_SIZE;
+	p.maxIter = maxIter > 0 ? maxIter : TUNE_ITER;
+
+	for (t = 0; t < (int)(sizeof(tiles) / sizeof(tiles[0])); t++) {
+		// a tile's carray, iterations and pixels should fit in L2
+		if (t > 0 && l2 > 0 && (long)tiles[t] * tiles[t] * (sizeof(double complex) + sizeof(int) + sizeof(double)) > l2) {
+			continue;
+		}
+		tileSize = tiles[t];
+		for (n = 0; n < numThreads; n++) {
+			p.numProcess = threads[n];
+			for (s = 0; s < 4; s++) {
+				snprintf(schedule, sizeof(schedule), "%s", schedules[s]);
+				total = 0.0;
+				for (v = 0; v < 2; v++) {
+					p.xMin = views[v][0] - views[v][2] / 2;
+					p.xMax = views[v][0] + views[v][2] / 2;
+					p.yMin = views[v][1] - views[v][2] / 2;
+					p.yMax = views[v][1] + views[v][2] / 2;
+					initialise(&p);
+					fastest = -1.0;
+					for (r = 0; r < TUNE_REPEATS; r++) {
+						start = omp_get_wtime();
+						runSchedule(&p);
+						elapsed = omp_get_wtime() - start;
+						fastest = fastest < 0 || elapsed < fastest ? elapsed : fastest;
+					}
+					total += fastest;
+				}
+				printf("%4d pixel tiles, %3d threads, %-8s %f\n", tileSize, p.numProcess, schedule, total);
+				if (best < 0 || total < best) {
+					best = total;
+					bestTile = tileSize;
+					bestThreads = p.numProcess;
+					snprintf(bestSchedule, sizeof(bestSchedule), "%s", schedule);
+				}
+			}
+		}
+	}
+	arenaFree(&arena);
+
+	if ((fp = fopen(path != NULL ? path : PROFILE, "w")) == NULL) {
+		perror("Cannot open profile file");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "# written by mbomp tune, calibration maxIter %d, %f s\n", p.maxIter, best);
+	fprintf(fp, "# %d CPUs, L1d %ldK, L2 %ldK, L3 %ldK, %s\n", cpus, l1 / 1024, l2 / 1024, l3 / 1024, simd);
+	fprintf(fp, "threads %d\nschedule %s\ntile %d\n", bestThreads, bestSchedule, bestTile);
+	fclose(fp);
+	printf("Best: %d threads, %s schedule, %d pixel tiles, written to %s\n", bestThreads, bestSchedule, bestTile, path != NULL ? path : PROFILE);
+}
+
+// read a decimal number into a double-double: the digits are accumulated
+// exactly (up to 32 of them) and scaled by a power of ten in double-double
+void ddParse(const char *s, double *hi, double *lo)
+{
+	double vh = 0.0, vl = 0.0, sh = 1.0, sl = 0.0, qh, ql, rh, rl, bb, t, ah, al, bh, bl, ph, pe;
+	int negative = 0, scale = 0, fraction = 0, e;
+
+	while (*s == ' ') {
+		s++;
+	}
+	if (*s == '-' || *s == '+') {
+		negative = *s++ == '-';
+	}
+	for (; (*s >= '0' && *s <= '9') || (*s == '.' && !fraction); s++) {
+		if (*s == '.') {
+			fraction = 1;
+			continue;
+		}
+		DD_MUL(vh, vl, vh, vl, 10.0, 0.0);
+		DD_ADD(vh, vl, vh, vl, (double)(*s - '0'), 0.0);
+		scale -= fraction;
+	}
+	if ((*s == 'e' || *s == 'E') && sscanf(s + 1, "%d", &e) == 1) {
+		scale += e;
+	}
+	for (e = scale < 0 ? -scale : scale; e > 0; e--) {
+		DD_MUL(sh, sl, sh, sl, 10.0, 0.0);
+	}
+	if (scale >= 0) {
+		DD_MUL(vh, vl, vh, vl, sh, sl);
+	}
+	else {
+		// v / s: a double quotient, then the remainder divided again
+		qh = vh / sh;
+		DD_MUL(rh, rl, qh, 0.0, sh, sl);
+		DD_ADD(rh, rl, vh, vl, -rh, -rl);
+		ql = rh / sh;
+		QUICK_TWO_SUM(vh, vl, qh, ql);
+	}
+	*hi = negative ? -vh : vh;
+	*lo = negative ? -vl : vl;
+}
+
+// decide on double-double for the view centred on the decimal strings x, y
+// with half-size size, and if so set the low parts of its corner
+int ddView(Parameters *p, const char *x, const char *y, double size)
+{
+	double xh, xl, yh, yl, bb, ph, pe, scale, step = 2.0 * size / p->width;
+	char *env = getenv("MANDEL_PRECISION");
+
+	scale = fmax(fmax(fabs(p->xMin), fabs(p->xMax)), fmax(fmax(fabs(p->yMin), fabs(p->yMax)), 1.0));
+	if (env != NULL && strcmp(env, "double") == 0) {
+		return 0;
+	}
+	if ((env == NULL || strcmp(env, "dd") != 0) && step >= DD_STEP * scale) {
+		return 0;
+	}
+	if (distance != NULL || fractal->ddKernel == NULL) {
+		printf("No double-double kernel for %s, the view is beyond double precision\n", distance != NULL ? "distance estimation" : fractal->name);
+		return 0;
+	}
+	if (step < DD_LIMIT * scale) {
+		printf("The view is beyond double-double precision too\n");
+	}
+
+	// yMax - yMin has cancelled away at these depths, take the step from size
+	p->step = step;
+	ddParse(x, &xh, &xl);
+	ddParse(y, &yh, &yl);
+	DD_ADD(p->xMin, p->xMinLo, xh, xl, -size, 0.0);
+	DD_ADD(p->yMax, p->yMaxLo, yh, yl, size, 0.0);
+	printf("Double-double kernel, step %g\n", p->step);
+	return 1;
+}
+
+// c of pixel (i, j) of a double-double view, corner + (j, -i) * step
+static void ddPixel(Parameters *p, int i, int j)
+{
+	double xh, xl, yh, yl, bb, t, ah, al, bh, bl, ph, pe, sh, sl;
+
+	TWO_PROD(sh, sl, (double)j, p->step);
+	DD_ADD(xh, xl, p->xMin, p->xMinLo, sh, sl);
+	TWO_PROD(sh, sl, (double)i, p->step);
+	DD_ADD(yh, yl, p->yMax, p->yMaxLo, -sh, -sl);
+	p->carray[i * p->width + j] = xh + yh * I;
+	p->clo[i * p->width + j] = xl + yl * I;
+}
+
+// report the main thread's counts for the stage just finished and count the next
+void stageDone(const char *stage, PerfCounters *c)
+{
+	if (!perf) {
+		return;
+	}
+	perfStop(c);
+	perfReport(stage, c, 0, 0.0, 0.0);
+	memset(c->value, 0, sizeof(c->value));
+	perfStart(c);
+}
 
 // initialise the Parameters structure and dynamically allocate required arrays
+// first-touch rows first..end-1 of the per-pixel arrays, page by page: each
+// array is touched on the pages that start within those rows
+static void touchRows(Parameters *p, int first, int end, const double *xs, const double *ys)
+{
+	long count = (long)p->width * p->height, from, to, n;
+
+	pageRange(p->pixels, sizeof(double), count, (long)first * p->width, (long)end * p->width, &from, &to);
+	for (n = from; n < to; n++) {
+		p->pixels[n] = 0.0;
+	}
+	pageRange(p->iterations, sizeof(int), count, (long)first * p->width, (long)end * p->width, &from, &to);
+	for (n = from; n < to; n++) {
+		p->iterations[n] = 0;
+	}
+	if (p->clo != NULL) {
+		pageRange(p->clo, sizeof(double complex), count, (long)first * p->width, (long)end * p->width, &from, &to);
+		for (n = from; n < to; n++) {
+			p->clo[n] = 0.0;
+		}
+	}
+	pageRange(p->carray, sizeof(double complex), count, (long)first * p->width, (long)end * p->width, &from, &to);
+	for (n = from; n < to; n++) {
+		if (p->clo != NULL) {
+			ddPixel(p, n / p->width, n % p->width);
+		}
+		else {
+			p->carray[n] = xs[n % p->width] + ys[n / p->width] * I;
+		}
+	}
+}
+
 void initialise(Parameters *p)
 {
-	int i, j;
-	double x, y;
+	int i, j, tilesAcross, numTiles;
+	double x, *xs, *ys;
 
-	p->step = (p->yMax - p->yMin) / p->width;
-	
-	if ((p->pixels = malloc(p->width * p->height * sizeof(double))) == NULL) {
-		perror("Cannot allocate memory (pixels)");
-		exit(EXIT_FAILURE);
+	if (p->clo == NULL) {
+		p->step = (p->yMax - p->yMin) / p->width;
 	}
 	
-	if ((p->carray = malloc(p->width * p->height * sizeof(double complex))) == NULL) {
-		perror("Cannot allocate memory (pixels)");
-		exit(EXIT_FAILURE);
-	}
+	arenaAlloc(&arena, p, ARENA_ALL);
 	
-	if ((p->iterations = malloc(p->width * p->height * sizeof(int))) == NULL) {
-		perror("Cannot allocate memory (iterations)");
+	// real/imaginary value of each column and row, as a serial fill and gridRows
+	if ((xs = malloc(p->width * sizeof(double))) == NULL || (ys = malloc(p->height * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (coordinates)");
 		exit(EXIT_FAILURE);
 	}
-	
-	if ((p->histogram = malloc(p->maxIter * sizeof(int))) == NULL) {
-		perror("Cannot allocate memory (histogram)");
-		exit(EXIT_FAILURE);
+	x = p->xMin;
+	for (j = 0; j < p->width; j++) {
+		xs[j] = x;
+		x += p->step;
 	}
-	
-	// initialise array with zeros
-	for (i = 0; i < p->height; i++) {
-		for (j = 0; j < p->width; j++) {
-			p->pixels[i * p->width + j] = 0.0;
-		}
+	gridRows(p->yMax, p->step, p->height, ys);
+
+	// pin the team and let each thread first-touch the pages of its band of
+	// tile rows, the band mandelTiles hands it first, so on NUMA machines the
+	// pages land next to the thread that computes them
+	tilesAcross = (p->width + tileSize - 1) / tileSize;
+	numTiles = tilesAcross * ((p->height + tileSize - 1) / tileSize);
+	free(bands);
+	if (posix_memalign((void **)&bands, 64, p->numProcess * sizeof(WorkBand)) != 0) {
+		perror("Cannot allocate memory (bands)");
+		exit(EXIT_FAILURE);
 	}
-	
-	// initialise carray with real/imaginary values for c
-	y = p->yMax;
-	for (i = 0; i < p->height; i++) {
-		x = p->xMin;
-		for (j = 0; j < p->width; j++) {
-			p->carray[i * p->width + j] = x + y * I;
-			x += p->step;
+	bandSplit(bands, p->numProcess, numTiles, tilesAcross);
+	#pragma omp parallel num_threads(p->numProcess)
+	{
+		int k, last;
+
+		pinWorker(omp_get_thread_num());
+		// a smaller team than asked for touches the bands without an owner too
+		for (k = omp_get_thread_num(); k < p->numProcess; k += omp_get_num_threads()) {
+			last = bands[k].end / tilesAcross * tileSize;
+			touchRows(p, bands[k].first / tilesAcross * tileSize, last < p->height ? last : p->height, xs, ys);
 		}
-		y -= p->step;
 	}
+	free(xs);
+	free(ys);
 	
 	for (i = 0; i < p->maxIter; i++) {
 		p->histogram[i] = 0;
@@ -0,0 +1,448 @@
+// Mandelbrot set Generation
+// Pipelined compute, colouring, encoding and output of mandel.dat
+// Bands of rows are computed by numThreads workers, and each worker encodes
+// its band into gnuplot text as soon as it is computed. A dedicated I/O
+// thread writes finished bands in order with writev while later bands are
+// still computing, so the output stage mostly hides behind compute.
+//
+// Colouring modes:
+//   hist   - histogram colouring (default). A pixel's colour is only known
+//            once every band is counted, so bands are encoded with a fixed
+//            width placeholder for the value, which is patched in place from
+//            a per-iteration table of value strings once the histogram is done.
+//   escape - log escape-time colouring, bands are final as soon as computed.
+// mandel.dat in hist mode is byte-identical to the other variants.
+
+// Example coordinates: mbpipe 10000 -0.668 0.32 0.02 6 hist
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#define BAND_ROWS 16	// rows handed to a thread at a time
+#define LINE_BYTES 48	// typical line, a band buffer starts with room for these
+#define LINE_MAX_BYTES 3 * 330	// worst case of three "%.12lf" fields
+#define VALUE_WIDTH 14	// "%.12lf" of a colour value in [0, 1]
+#define IOV_BATCH 1024	// bands per writev, the usual IOV_MAX
+
+enum{HIST, ESCAPE};
+
+typedef struct {
+	char *text;  // encoded lines of the band
+	size_t length;
+	int *iter;  // iteration count of each pixel, hist mode only
+	unsigned int *value;  // offset in text of each pixel's value field, hist mode only
+	int ready;  // text is final and may be written
+} Band;
+
+typedef struct {
+	Parameters *p;
+	double *xs;  // real value for each column, dim: width
+	double *ys;  // imaginary value for each row, dim: height
+	Band *bands;
+	int numBands;
+	int colour;  // HIST or ESCAPE
+	int nextBand;  // next band to compute
+	int nextPatch;  // next band to patch with colour values
+	long long *histogram;  // merged histogram of iteration counts, dim: maxIter
+	char *values;  // "%.12lf" text of each iteration count's colour, dim: maxIter * VALUE_WIDTH
+	int fd;  // mandel.dat
+	double start, computed, written;  // seconds since start of compute
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_barrier_t counted;  // every band computed and histogram merged
+} Pipeline;
+
+/* function prototypes */
+void initialise(Parameters *p, Pipeline *s);
+void pipelineCompute(Pipeline *s);
+void *doWork(void *arg);
+void *writeBands(void *arg);
+int mandelPixel(double complex c, int maxIter);
+void computeBand(Pipeline *s, int band, long long *histogram);
+void patchBand(Pipeline *s, int band);
+void buildValues(Pipeline *s);
+void freeMemory(Pipeline *s);
+double now(void);
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	int maxIter, numThreads = 2;
+	double xc, yc, size;
+	char mode[16] = "hist";
+	Parameters p;
+	Pipeline s;
+
+	if (argc < 2) {
+		printf("Usage: mandelbrot maxIter [x y size numThreads [hist|escape]]\n\nUsing default values\n");
+		maxIter = 5000;
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc == 2) {
+		sscanf(argv[1], "%i", &maxIter);
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc >= 6) {
+		sscanf(argv[1], "%i", &maxIter);
+		sscanf(argv[2], "%lf", &xc);
+		sscanf(argv[3], "%lf", &yc);
+		sscanf(argv[4], "%lf", &size);
+		sscanf(argv[5], "%i", &numThreads);
+		if (argc >= 7) {
+			sscanf(argv[6], "%15s", mode);
+		}
+
+		size = size / 2;
+		p.xMin = xc - size;
+		p.yMin = yc - size;
+		p.xMax = xc + size;
+		p.yMax = yc + size;
+	}
+
+	p.maxIter = maxIter;
+	p.height = HEIGHT;
+	p.width = WIDTH;
+	p.numProcess = numThreads;
+	s.colour = strcmp(mode, "escape") == 0 ? ESCAPE : HIST;
+
+	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
+	printf("%d compute threads, %s colouring\n", p.numProcess, s.colour == HIST ? "histogram" : "escape-time");
+
+	initialise(&p, &s);
+	pipelineCompute(&s);
+	printf("Compute finished after %f, output finished after %f\n", s.computed, s.written);
+	freeMemory(&s);
+
+	return (0);
+}
+
+// wall clock in seconds
+double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// set up coordinate tables and the band list, open mandel.dat
+void initialise(Parameters *p, Pipeline *s)
+{
+	int j;
+	double x;
+
+	p->step = (p->yMax - p->yMin) / p->width;
+	p->carray = NULL;
+	p->pixels = NULL;
+	p->iterations = NULL;
+	p->histogram = NULL;
+
+	s->p = p;
+	s->numBands = (p->height + BAND_ROWS - 1) / BAND_ROWS;
+	s->values = NULL;
+
+	if ((s->xs = malloc(p->width * sizeof(double))) == NULL ||
+		(s->ys = malloc(p->height * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (coordinates)");
+		exit(EXIT_FAILURE);
+	}
+	if ((s->bands = calloc(s->numBands, sizeof(Band))) == NULL) {
+		perror("Cannot allocate memory (bands)");
+		exit(EXIT_FAILURE);
+	}
+	if ((s->histogram = calloc(p->maxIter, sizeof(long long))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+
+	// same grid as initialise in the other variants, so c matches carray exactly
+	x = p->xMin;
+	for (j = 0; j < p->width; j++) {
+		s->xs[j] = x;
+		x += p->step;
+	}
+	gridRows(p->yMax, p->step, p->height, s->ys);
+
+	if ((s->fd = open("mandel.dat", O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror("Cannot open mandel.dat file");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	pthread_barrier_init(&s->counted, NULL, p->numProcess);
+}
+
+// iterate a single point, returns the same count as mandelCompute
+int mandelPixel(double complex c, int maxIter)
+{
+	double complex z = 0 + 0 * I;
+	int k;
+
+	for (k = 0; k < maxIter; k++) {
+		z = z * z + c;
+		if (cabs(z) > 2.0) {
+			return k;  // Not in Mandelbrot set
+		}
+	}
+	return maxIter - 1;  // In Mandelbrot set
+}
+
+// compute one band and encode it, in hist mode the value field is left as a
+// placeholder and its offset remembered
+void computeBand(Pipeline *s, int band, long long *histogram)
+{
+	Parameters *p = s->p;
+	Band *b = &s->bands[band];
+	int i, j, k, n = 0;
+	int first = band * BAND_ROWS;
+	int rows = first + BAND_ROWS < p->height ? BAND_ROWS : p->height - first;
+	size_t capacity = (size_t)rows * (p->width * LINE_BYTES + 1) + LINE_MAX_BYTES;
+	double value;
+
+	if ((b->text = malloc(capacity)) == NULL) {
+		perror("Cannot allocate memory (band text)");
+		exit(EXIT_FAILURE);
+	}
+	if (s->colour == HIST &&
+		((b->iter = malloc((size_t)rows * p->width * sizeof(int))) == NULL ||
+		(b->value = malloc((size_t)rows * p->width * sizeof(unsigned int))) == NULL)) {
+		perror("Cannot allocate memory (band)");
+		exit(EXIT_FAILURE);
+	}
+
+	b->length = 0;
+	for (i = first; i < first + rows; i++) {
+		for (j = 0; j < p->width; j++, n++) {
+			k = mandelPixel(s->xs[j] + s->ys[i] * I, p->maxIter);
+			if (s->colour == ESCAPE) {
+				value = k == p->maxIter - 1 ? 0.0 : log(k + 1) / log(p->maxIter);
+			}
+			else {
+				histogram[k]++;
+				b->iter[n] = k;
+				value = 0.0;
+			}
+			if (capacity - b->length < LINE_MAX_BYTES + 1) {
+				capacity *= 2;
+				if ((b->text = realloc(b->text, capacity)) == NULL) {
+					perror("Cannot allocate memory (band text)");
+					exit(EXIT_FAILURE);
+				}
+			}
+			b->length += formatFixed(b->text + b->length, s->xs[j]);
+			b->text[b->length++] = ' ';
+			b->length += formatFixed(b->text + b->length, s->ys[i]);
+			b->text[b->length++] = ' ';
+			b->length += formatFixed(b->text + b->length, value);
+			b->text[b->length++] = '\n';
+			if (s->colour == HIST) {
+				b->value[n] = b->length - 1 - VALUE_WIDTH;
+			}
+		}
+		b->text[b->length++] = '\n';
+	}
+}
+
+// format the colour of every iteration count once, each is exactly VALUE_WIDTH
+// characters because histogram colours lie in [0, 1]
+void buildValues(Pipeline *s)
+{
+	Parameters *p = s->p;
+	double *table;
+	char field[32];
+	int k;
+
+	if ((table = malloc(p->maxIter * sizeof(double))) == NULL ||
+		(s->values = malloc((size_t)p->maxIter * VALUE_WIDTH)) == NULL) {
+		perror("Cannot allocate memory (colour table)");
+		exit(EXIT_FAILURE);
+	}
+	histogramTable(s->histogram, p->maxIter, table);
+	for (k = 0; k < p->maxIter; k++) {
+		if (snprintf(field, sizeof(field), "%.12lf", table[k]) != VALUE_WIDTH) {
+			fprintf(stderr, "Colour value %f out of range\n", table[k]);
+			exit(EXIT_FAILURE);
+		}
+		memcpy(&s->values[(size_t)k * VALUE_WIDTH], field, VALUE_WIDTH);
+	}
+	free(table);
+}
+
+// fill in the value fields of a band from the table
+void patchBand(Pipeline *s, int band)
+{
+	Parameters *p = s->p;
+	Band *b = &s->bands[band];
+	int n, rows = band * BAND_ROWS + BAND_ROWS < p->height ? BAND_ROWS : p->height - band * BAND_ROWS;
+
+	for (n = 0; n < rows * p->width; n++) {
+		memcpy(b->text + b->value[n], &s->values[(size_t)b->iter[n] * VALUE_WIDTH], VALUE_WIDTH);
+	}
+	free(b->iter);
+	free(b->value);
+	b->iter = NULL;
+	b->value = NULL;
+}
+
+// mark a band final and wake the writer
+static void bandReady(Pipeline *s, int band)
+{
+	pthread_mutex_lock(&s->lock);
+	s->bands[band].ready = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+// compute bands until none are left; in hist mode merge the histogram, wait
+// for the others, and then patch bands in order so the writer can follow
+void *doWork(void *arg)
+{
+	Pipeline *s = (Pipeline *)arg;
+	long long *histogram;
+	int band, k;
+
+	if ((histogram = calloc(s->p->maxIter, sizeof(long long))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		band = s->nextBand++;
+		pthread_mutex_unlock(&s->lock);
+		if (band >= s->numBands) {
+			break;
+		}
+		computeBand(s, band, histogram);
+		if (s->colour == ESCAPE) {
+			bandReady(s, band);
+		}
+	}
+
+	if (s->colour == HIST) {
+		pthread_mutex_lock(&s->lock);
+		for (k = 0; k < s->p->maxIter; k++) {
+			s->histogram[k] += histogram[k];
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		if (pthread_barrier_wait(&s->counted) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			s->computed = now() - s->start;
+			buildValues(s);
+		}
+		pthread_barrier_wait(&s->counted);
+
+		for (;;) {
+			pthread_mutex_lock(&s->lock);
+			band = s->nextPatch++;
+			pthread_mutex_unlock(&s->lock);
+			if (band >= s->numBands) {
+				break;
+			}
+			patchBand(s, band);
+			bandReady(s, band);
+		}
+	}
+	free(histogram);
+	return(NULL);
+}
+
+// I/O thread: write every run of consecutive finished bands with one writev
+void *writeBands(void *arg)
+{
+	Pipeline *s = (Pipeline *)arg;
+	struct iovec iov[IOV_BATCH];
+	int next = 0, n, i, first;
+	ssize_t written;
+
+	while (next < s->numBands) {
+		pthread_mutex_lock(&s->lock);
+		while (!s->bands[next].ready) {
+			pthread_cond_wait(&s->cond, &s->lock);
+		}
+		for (n = 0; next + n < s->numBands && n < IOV_BATCH && s->bands[next + n].ready; n++) {
+			iov[n].iov_base = s->bands[next + n].text;
+			iov[n].iov_len = s->bands[next + n].length;
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		// writev may stop short, move past what went out and go again
+		for (first = 0; first < n; ) {
+			if ((written = writev(s->fd, &iov[first], n - first)) < 0) {
+				perror("Cannot write mandel.dat file");
+				exit(EXIT_FAILURE);
+			}
+			while (first < n && (size_t)written >= iov[first].iov_len) {
+				written -= iov[first].iov_len;
+				first++;
+			}
+			if (first < n) {
+				iov[first].iov_base = (char *)iov[first].iov_base + written;
+				iov[first].iov_len -= written;
+			}
+		}
+
+		for (i = next; i < next + n; i++) {
+			free(s->bands[i].text);
+			s->bands[i].text = NULL;
+		}
+		next += n;
+	}
+	s->written = now() - s->start;
+	return(NULL);
+}
+
+// start the compute workers and the I/O thread and wait for all of them
+void pipelineCompute(Pipeline *s)
+{
+	Parameters *p = s->p;
+	pthread_t *thr, writer;
+	int i;
+
+	if ((thr = malloc(p->numProcess * sizeof(pthread_t))) == NULL) {
+		perror("Cannot allocate memory (threads)");
+		exit(EXIT_FAILURE);
+	}
+
+	s->nextBand = 0;
+	s->nextPatch = 0;
+	s->start = now();
+	pthread_create(&writer, NULL, writeBands, (void *)s);
+	for (i = 0; i < p->numProcess; i++) {
+		pthread_create(&thr[i], NULL, doWork, (void *)s);
+	}
+	for (i = 0; i < p->numProcess; i++) {
+		pthread_join(thr[i], NULL);
+	}
+	if (s->colour == ESCAPE) {
+		s->computed = now() - s->start;
+	}
+	pthread_join(writer, NULL);
+	printf("Threads Joined\n");
+	free(thr);
+}
+
+// free all dynamic memory in the Pipeline structure
+void freeMemory(Pipeline *s)
+{
+	printf("	-> Freeing Memory <-\n");
+	close(s->fd);
+	pthread_barrier_destroy(&s->counted);
+	free(s->bands);
+	free(s->xs);
+	free(s->ys);
+	free(s->histogram);
+	free(s->values);
+}
@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <complex.h>
 #include <time.h>
@@ -25,16 +26,36 @@ void writeToFile(Parameters);
 void histogramColouring(Parameters *p);
 void freeMemory(Parameters p);
 void parrmandelCompute(Parameters *p);
-void *doWork(void *argv);
+void touchJob(int worker, void *arg);
+void computeJob(int worker, void *arg);
+void firstTouch(Parameters *p, int start, int end);
+void panView(Parameters *p, const char *spec);
 
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+#define CACHE_LINE 64
+#define CHUNKS_PER_WORKER 8	// claims per worker on an even frame, more smooth out the load
+#define PREDICT_ROWS 32	// smallest claim with MANDEL_PREDICT=1, so the prediction grid has cells
 
+// one worker's state, on cache lines of its own so neighbours never share one
+typedef struct {
+	Parameters chunk;  // the run of rows currently being computed
+	PredictStats stats;  // this worker's prediction counts, with MANDEL_PREDICT=1
+	int firstRow, endRow;  // rows whose pages this worker first-touches
+} __attribute__((aligned(CACHE_LINE))) Index;
 
+// the frame the pool is working on
 typedef struct {
-	int start, chunkSize;
-} Index;
+	Parameters *p;  // whole frame
+	int *rows, numRows;  // rows to compute, mirrored rows are left out
+	int chunkRows;  // entries of rows claimed at a time
+	WorkBand *bands;  // entries of rows each worker first-touches and claims first
+	Index *workers;
+} Frame;
+
 
 
+Arena arena;  // backing store for pixels, carray, iterations and histogram
+int predict = 0;  // MANDEL_PREDICT=1 computes through mandelPredict
+Pool *pool;  // workers for the frame and any pans, started once in main
 
 /* main program – execution begins here */
 int main(int argc, char *argv[])
@@ -54,6 +75,7 @@ int main(int argc, char *argv[])
 		sscanf(argv[1], "%i", &maxIter);
 		p.xMin = p.yMin = -2;
 		p.xMax = p.yMax = 2;
+		p.numProcess = 2;
 	}
 	else if (argc == 6) {
 		sscanf(argv[1], "%i", &maxIter);
@@ -72,15 +94,27 @@ int main(int argc, char *argv[])
 	p.maxIter = maxIter;
 	p.height = HEIGHT;
 	p.width = WIDTH;
+	p.xMinLo = p.yMaxLo = 0.0;
+	p.clo = NULL;
 	//Number of threads
+	predict = getenv("MANDEL_PREDICT") != NULL && strcmp(getenv("MANDEL_PREDICT"), "1") == 0;
 
 	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
 	
+	affinityInit();
+	pool = poolCreate(p.numProcess);
 	initialise(&p);
 	parrmandelCompute(&p);
+	if (getenv("MANDEL_PAN") != NULL) {
+		panView(&p, getenv("MANDEL_PAN"));
+	}
+	if (getenv("MANDEL_SAVE_ITER") != NULL) {
+		iterSave(&p, getenv("MANDEL_SAVE_ITER"), NULL);
+	}
 	//Compute(&p, numThreads);
 	histogramColouring(&p);
 	writeToFile(p);
+	poolDestroy(pool);
 	freeMemory(p);
 	return (0);
 }
@@ -90,10 +124,7 @@ void freeMemory(Parameters p)
 {
 	//freeMemory_lib(p);
 	printf("	-> Freeing Memory <-\n");
-	free(p.carray);
-	free(p.iterations);
-	free(p.histogram);
-	free(p.pixels);
+	arenaFree(&arena);
 }
 
 // write coordinates and values to file for gnuplot
@@ -101,23 +132,7 @@ void writeToFile(Parameters p)
 {
 	//writeToFile_lib(p);
 	printf("	-> Using custom writeToFile <-\n");
-	FILE *fp;
-	double complex c;
-	
-	//Attempt to open the file
-	if((fp = fopen("mandel.dat", "w")) == NULL){
-		perror("Cannot open mandel.dat file");
-		exit(EXIT_FAILURE);
-	}
-
-	for(int i=0; i < p.height; i++){
-		for(int j=0; j < p.width; j++){
-			c = p.carray[i * p.width + j];
-			fprintf(fp, "%.12lf %.12lf %.12lf\n", creal(c), cimag(c), p.pixels[i*p.width + j]);
-		}
-		fprintf(fp, "\n");
-	}
-	fclose(fp);
+	writeDat(p, "mandel.dat");
 }
 
 // compute the colour for each pixel using histogram algorithm
@@ -153,83 +168,168 @@ void mandelCompute(Parameters *p)
 	}
 }
 
-void *doWork(void *arg)
+// fill the pages of this worker's band of rows
+void touchJob(int worker, void *arg)
 {
-	Parameters *p = (Parameters *)arg;
-	mandelCompute(p);
-	return(NULL);
+	Frame *f = (Frame *)arg;
+
+	firstTouch(f->p, f->workers[worker].firstRow, f->workers[worker].endRow);
+}
+
+// claim chunkRows entries of rows at a time, from this worker's band first and
+// then from the others until none are left, computing each run of consecutive
+// rows in one call
+void computeJob(int worker, void *arg)
+{
+	Frame *f = (Frame *)arg;
+	Index *idx = &f->workers[worker];
+	int first, last, count;
+
+	while ((first = bandClaim(f->bands, f->p->numProcess, worker, f->chunkRows, &count)) >= 0) {
+		last = first + count;
+		for (int r = first, n; r < last; r += n) {
+			for (n = 1; r + n < last && f->rows[r + n] == f->rows[r] + n; n++);
+			idx->chunk.carray = &(f->p->carray[f->rows[r] * f->p->width]);
+			idx->chunk.iterations = &(f->p->iterations[f->rows[r] * f->p->width]);
+			idx->chunk.height = n;
+			if (predict) {
+				mandelPredict(&idx->chunk, 0, 0, idx->chunk.width, n, &idx->stats);
+			}
+			else {
+				mandelCompute(&idx->chunk);
+			}
+		}
+	}
 }
 
 void parrmandelCompute(Parameters *p)
 {
-	pthread_t thr[p->numProcess];
-	Parameters pthr[p->numProcess];
-	int chunkSize = p->height / p->numProcess;
-	int start;
-
-	for(int i=0; i < p->numProcess; i++){
-		start = i * chunkSize;
-		printf("Creating Thread %d starting at %d with a chunkSize of %d\n", i, start, chunkSize);
-		pthr[i].carray = &(p->carray[start * p->width]);
-		pthr[i].height = chunkSize;
-		pthr[i].width = p->width;
-		pthr[i].maxIter = p->maxIter;
-		pthr[i].iterations = &(p->iterations[start * p->width]);
-		pthread_create(&thr[i], NULL, doWork, (void *)&pthr[i]);
+	Frame f;
+	int align, *mirror;
+
+	// rows with an exact mirror image are copied afterwards, the rest are claimed by the workers
+	if ((mirror = malloc(p->height * sizeof(int))) == NULL || (f.rows = malloc(p->height * sizeof(int))) == NULL ||
+		posix_memalign((void **)&f.workers, CACHE_LINE, p->numProcess * sizeof(Index)) != 0 ||
+		posix_memalign((void **)&f.bands, CACHE_LINE, p->numProcess * sizeof(WorkBand)) != 0) {
+		perror("Cannot allocate memory (workers)");
+		exit(EXIT_FAILURE);
+	}
+	symmetryPlan(p, mirror);
+	f.numRows = 0;
+	for (int i = 0; i < p->height; i++) {
+		if (mirror[i] < 0) {
+			f.rows[f.numRows++] = i;
+		}
 	}
+	f.p = p;
 
-	
-	for(int i=0; i < p->numProcess; i++){
-		pthread_join(thr[i], NULL);
+	// claims are whole cache lines of iterations, so two workers never write the same line
+	for (align = 1; (align * p->width * sizeof(int)) % CACHE_LINE != 0; align++);
+	f.chunkRows = f.numRows / (p->numProcess * CHUNKS_PER_WORKER);
+	if (predict && f.chunkRows < PREDICT_ROWS) {
+		f.chunkRows = PREDICT_ROWS;
 	}
+	f.chunkRows = f.chunkRows < align ? align : (f.chunkRows + align - 1) / align * align;
+	printf("Computing %d of %d rows, %d rows at a time\n", f.numRows, p->height, f.chunkRows);
+
+	// each worker owns a band of whole claims and first-touches the rows from
+	// its band's first row up to the next band's, mirrored rows included
+	bandSplit(f.bands, p->numProcess, f.numRows, f.chunkRows);
+	for (int i = 0; i < p->numProcess; i++) {
+		memset(&f.workers[i], 0, sizeof(Index));
+		f.workers[i].chunk.width = p->width;
+		f.workers[i].chunk.maxIter = p->maxIter;
+		f.workers[i].firstRow = i == 0 ? 0 : f.bands[i].first < f.numRows ? f.rows[f.bands[i].first] : p->height;
+		if (i > 0) {
+			f.workers[i - 1].endRow = f.workers[i].firstRow;
+		}
+	}
+	f.workers[p->numProcess - 1].endRow = p->height;
+	for (int i = 0; i < p->numProcess; i++) {
+		printf("Creating Thread %d starting at %d with a chunkSize of %d\n", i, f.workers[i].firstRow,
+			f.workers[i].endRow - f.workers[i].firstRow);
+	}
+	poolRun(pool, touchJob, &f);
+	poolRun(pool, computeJob, &f);
 	printf("Threads Joined\n");
+
+	if (predict) {
+		for (int i = 1; i < p->numProcess; i++) {
+			predictAdd(&f.workers[0].stats, &f.workers[i].stats);
+		}
+		predictReport(&f.workers[0].stats);
+	}
+	symmetryCopy(p, mirror);
+	free(mirror);
+	free(f.rows);
+	free(f.workers);
+	free(f.bands);
 }
 
-// initialise the Parameters structure and dynamically allocate required arrays
-void initialise(Parameters *p)
+// MANDEL_PAN=dx,dy[,frames]: move the rendered view dx pixels right and dy
+// down, frames times, computing only the strips each move exposes
+void panView(Parameters *p, const char *spec)
 {
-	int i, j;
-	double x, y;
+	struct timespec start, end;
+	int dx = 0, dy = 0, frames = 1;
 
-	p->step = (p->yMax - p->yMin) / WIDTH;
-	
-	if ((p->pixels = malloc(WIDTH * HEIGHT * sizeof(double))) == NULL) {
-		perror("Cannot allocate memory (pixels)");
-		exit(EXIT_FAILURE);
-	}
-	
-	if ((p->carray = malloc(WIDTH * HEIGHT * sizeof(double complex))) == NULL) {
-		perror("Cannot allocate memory (pixels)");
+	if (sscanf(spec, "%d,%d,%d", &dx, &dy, &frames) < 2 || frames < 1) {
+		fprintf(stderr, "MANDEL_PAN must be dx,dy[,frames]\n");
 		exit(EXIT_FAILURE);
 	}
-	
-	if ((p->iterations = malloc(WIDTH * HEIGHT * sizeof(int))) == NULL) {
-		perror("Cannot allocate memory (iterations)");
-		exit(EXIT_FAILURE);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < frames; i++) {
+		regionPan(pool, p, dx, dy);
 	}
-	
-	if ((p->histogram = malloc(p->maxIter * sizeof(int))) == NULL) {
-		perror("Cannot allocate memory (histogram)");
-		exit(EXIT_FAILURE);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Panned %d frames by (%d, %d) in %f\n", frames, dx, dy, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\n", p->xMin, p->xMax, p->yMin, p->yMax);
+}
+
+// fill pixels, iterations and carray on the pages that start within rows
+// start..end-1, from the worker whose band of claims covers those rows, so on
+// NUMA machines the pages land on the node of the thread that computes them
+// first (a worker that runs out of its own band steals from the others)
+void firstTouch(Parameters *p, int start, int end)
+{
+	long count = (long)p->width * p->height, from, to, n;
+	int i, j;
+	double x, y;
+
+	pageRange(p->pixels, sizeof(double), count, (long)start * p->width, (long)end * p->width, &from, &to);
+	for (n = from; n < to; n++) {
+		p->pixels[n] = 0.0;
 	}
-	
-	// initialise array with zeros
-	for (i = 0; i < HEIGHT; i++) {
-		for (j = 0; j < WIDTH; j++) {
-			p->pixels[i * WIDTH + j] = 0.0;
-		}
+	pageRange(p->iterations, sizeof(int), count, (long)start * p->width, (long)end * p->width, &from, &to);
+	for (n = from; n < to; n++) {
+		p->iterations[n] = 0;
 	}
-	
-	// initialise carray with real/imaginary values for c
-	y = p->yMax;
-	for (i = 0; i < HEIGHT; i++) {
+
+	// the rows of gridY, so c is the same as in a serial fill
+	pageRange(p->carray, sizeof(double complex), count, (long)start * p->width, (long)end * p->width, &from, &to);
+	for (i = from / p->width; from < to && i <= (to - 1) / p->width; i++) {
+		y = gridY(p->yMax, p->step, i);
 		x = p->xMin;
-		for (j = 0; j < WIDTH; j++) {
-			p->carray[i * WIDTH + j] = x + y * I;
+		for (j = 0; j < p->width; j++) {
+			n = (long)i * p->width + j;
+			if (n >= from && n < to) {
+				p->carray[n] = x + y * I;
+			}
 			x += p->step;
 		}
-		y -= p->step;
 	}
+}
+
+// initialise the Parameters structure and dynamically allocate required arrays
+void initialise(Parameters *p)
+{
+	int i;
+
+	p->step = (p->yMax - p->yMin) / WIDTH;
+	
+	arenaAlloc(&arena, p, ARENA_ALL);
+	
+	// pixels, iterations and carray are filled by the workers in firstTouch
 	
 	for (i = 0; i < p->maxIter; i++) {
 		p->histogram[i] = 0;
@@ -0,0 +1,589 @@
+// Mandelbrot set Generation
+// Quadtree tile pyramid (tiles/z/x/y.png) for a deep-zoom viewer in one run
+// Leaves at zoom level maxZoom are computed with mandelCompute, every parent
+// is a 2x2 box downsample of its four children rather than a recomputation.
+//   pass 1 - compute the leaves in parallel, spill iteration counts to a
+//            scratch file and build the global histogram
+//   pass 2 - each thread takes a subtree and walks it depth first, colouring
+//            leaves and downsampling parents on the way back up
+// Tiles of a single colour (e.g. the interior of the set) are written once
+// and hard linked everywhere else they occur.
+
+// Example coordinates: mbpyr 2000 -0.5 0 3 6 6 256
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define TILE_SIZE 256	// default tile edge in pixels
+#define SPLIT_LEVEL 3	// subtrees rooted at this level are handed to threads
+
+enum{COMPUTE, BUILD};
+
+typedef struct {
+	Parameters *p;
+	int tileSize;
+	int maxZoom;
+	int splitLevel;  // min(SPLIT_LEVEL, maxZoom)
+	int leavesAcross;  // 2^maxZoom
+	int iterBytes;  // 2 when maxIter < 65536, 4 otherwise
+	int scratch;  // file descriptor of the leaf iteration spill file
+	long long *histogram;  // global histogram, dim: maxIter
+	double *table;  // colour value for each iteration count, dim: maxIter
+	unsigned char **roots;  // coloured subtree roots, dim: 4^splitLevel
+	int *rootUniform;
+	int phase;
+	int next;  // next leaf / subtree to hand out
+	int numWork;
+	long written, linked;
+	pthread_mutex_t lock;
+} Pyramid;
+
+/* function prototypes */
+void initialise(Parameters *p, Pyramid *py);
+void pyramidCompute(Pyramid *py);
+void *doWork(void *arg);
+void mandelCompute(Parameters *p);
+void computeLeaf(Pyramid *py, Parameters *lp, int x, int y, long long *histogram, uint16_t *iter16);
+int buildTile(Pyramid *py, int z, int x, int y, unsigned char *rgb, unsigned char **tmp, void *iters);
+void downsample(Pyramid *py, unsigned char *child, int quadrant, unsigned char *rgb);
+int isUniform(Pyramid *py, unsigned char *rgb);
+void writeTile(Pyramid *py, int z, int x, int y, unsigned char *rgb, int uniform);
+void writePNG(const char *path, unsigned char *rgb, int width, int height);
+void makeDirectories(Pyramid *py);
+void freeMemory(Pyramid *py);
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	int maxIter, numThreads = 2;
+	double xc, yc, size;
+	Parameters p;
+	Pyramid py;
+
+	py.maxZoom = 3;
+	py.tileSize = TILE_SIZE;
+
+	if (argc < 2) {
+		printf("Usage: mandelbrot maxIter [x y size numThreads [maxZoom [tileSize]]]\n\nUsing default values\n");
+		maxIter = 5000;
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc == 2) {
+		sscanf(argv[1], "%i", &maxIter);
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc >= 6) {
+		sscanf(argv[1], "%i", &maxIter);
+		sscanf(argv[2], "%lf", &xc);
+		sscanf(argv[3], "%lf", &yc);
+		sscanf(argv[4], "%lf", &size);
+		sscanf(argv[5], "%i", &numThreads);
+		if (argc >= 7) {
+			sscanf(argv[6], "%i", &py.maxZoom);
+		}
+		if (argc >= 8) {
+			// parents average 2x2 blocks of their children, so tiles must halve exactly
+			if (sscanf(argv[7], "%i", &py.tileSize) != 1 || py.tileSize < 2 || py.tileSize > 8192 || py.tileSize % 2 != 0) {
+				printf("Usage: mandelbrot maxIter [x y size numThreads [maxZoom [tileSize]]]\n\ntileSize must be even and 2 to 8192\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		size = size / 2;
+		p.xMin = xc - size;
+		p.yMin = yc - size;
+		p.xMax = xc + size;
+		p.yMax = yc + size;
+	}
+
+	p.maxIter = maxIter;
+	p.numProcess = numThreads;
+
+	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
+
+	initialise(&p, &py);
+	pyramidCompute(&py);
+	printf("Wrote %ld tiles, %ld duplicates hard linked\n", py.written, py.linked);
+	freeMemory(&py);
+
+	return (0);
+}
+
+// set up the pyramid geometry, directories and scratch file
+void initialise(Parameters *p, Pyramid *py)
+{
+	int i, numRoots;
+
+	py->p = p;
+	py->leavesAcross = 1 << py->maxZoom;
+	py->splitLevel = py->maxZoom < SPLIT_LEVEL ? py->maxZoom : SPLIT_LEVEL;
+	py->iterBytes = p->maxIter < 65536 ? 2 : 4;
+	py->written = py->linked = 0;
+
+	// the whole pyramid is one square image of tileSize * 2^maxZoom pixels
+	p->width = p->height = py->tileSize * py->leavesAcross;
+	p->step = (p->yMax - p->yMin) / p->width;
+	p->carray = NULL;
+	p->pixels = NULL;
+	p->iterations = NULL;
+	p->histogram = NULL;
+
+	if ((py->histogram = calloc(p->maxIter, sizeof(long long))) == NULL ||
+		(py->table = malloc(p->maxIter * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+
+	numRoots = 1 << (2 * py->splitLevel);
+	if ((py->roots = malloc(numRoots * sizeof(unsigned char *))) == NULL ||
+		(py->rootUniform = malloc(numRoots * sizeof(int))) == NULL) {
+		perror("Cannot allocate memory (roots)");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < numRoots; i++) {
+		if ((py->roots[i] = malloc((size_t)py->tileSize * py->tileSize * 3)) == NULL) {
+			perror("Cannot allocate memory (roots)");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if ((py->scratch = open("mandel.tiles.tmp", O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+		perror("Cannot open mandel.tiles.tmp file");
+		exit(EXIT_FAILURE);
+	}
+	unlink("mandel.tiles.tmp");
+
+	makeDirectories(py);
+	printf("Pyramid of %d levels, %d x %d leaf tiles of %d pixels\n", py->maxZoom + 1,
+		py->leavesAcross, py->leavesAcross, py->tileSize);
+
+	pthread_mutex_init(&py->lock, NULL);
+}
+
+void makeDirectories(Pyramid *py)
+{
+	char path[300];
+	struct dirent *entry;
+	DIR *dir;
+	int z, x;
+
+	mkdir("tiles", 0755);
+	// shared single colour tiles of an earlier run may have another tileSize,
+	// tiles already linked to them keep their own copy
+	if ((dir = opendir("tiles")) != NULL) {
+		while ((entry = readdir(dir)) != NULL) {
+			if (strncmp(entry->d_name, "uniform_", 8) == 0) {
+				snprintf(path, sizeof(path), "tiles/%s", entry->d_name);
+				unlink(path);
+			}
+		}
+		closedir(dir);
+	}
+	for (z = 0; z <= py->maxZoom; z++) {
+		snprintf(path, sizeof(path), "tiles/%d", z);
+		mkdir(path, 0755);
+		for (x = 0; x < (1 << z); x++) {
+			snprintf(path, sizeof(path), "tiles/%d/%d", z, x);
+			if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+				perror("Cannot create tile directory");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+}
+
+// test each point in the complex plane to see if it is in the set or not
+void mandelCompute(Parameters *p)
+{
+	double complex c, z;
+	int i, j, k;
+
+	for (i = 0; i < p->height; i++) {
+		for (j = 0; j < p->width; j++) {
+			z = 0 + 0 * I;
+			c = p->carray[i * p->width + j];
+			for (k = 0; k < p->maxIter; k++) {
+				z = z * z + c;
+				if (cabs(z) > 2.0) {
+					p->iterations[i * p->width + j] = k;
+					break;
+				}
+			}
+			if (k >= p->maxIter) {
+				p->iterations[i * p->width + j] = p->maxIter - 1;
+			}
+		}
+	}
+}
+
+// fill the leaf's carray, run mandelCompute on it and spill the result
+void computeLeaf(Pyramid *py, Parameters *lp, int x, int y, long long *histogram, uint16_t *iter16)
+{
+	Parameters *p = py->p;
+	int i, j, t = py->tileSize;
+	size_t n, leafPixels = (size_t)t * t;
+	double re, im;
+
+	im = p->yMax - (double)y * t * p->step;
+	for (i = 0; i < t; i++) {
+		re = p->xMin + (double)x * t * p->step;
+		for (j = 0; j < t; j++) {
+			lp->carray[i * t + j] = re + im * I;
+			re += p->step;
+		}
+		im -= p->step;
+	}
+
+	mandelCompute(lp);
+
+	for (n = 0; n < leafPixels; n++) {
+		histogram[lp->iterations[n]]++;
+		if (py->iterBytes == 2) {
+			iter16[n] = (uint16_t)lp->iterations[n];
+		}
+	}
+
+	n = (size_t)y * py->leavesAcross + x;
+	if (pwrite(py->scratch, py->iterBytes == 2 ? (void *)iter16 : (void *)lp->iterations,
+		leafPixels * py->iterBytes, (off_t)(n * leafPixels * py->iterBytes)) != (ssize_t)(leafPixels * py->iterBytes)) {
+		perror("Cannot write mandel.tiles.tmp file");
+		exit(EXIT_FAILURE);
+	}
+}
+
+int isUniform(Pyramid *py, unsigned char *rgb)
+{
+	size_t n, numPixels = (size_t)py->tileSize * py->tileSize;
+
+	for (n = 1; n < numPixels; n++) {
+		if (rgb[n * 3] != rgb[0] || rgb[n * 3 + 1] != rgb[1] || rgb[n * 3 + 2] != rgb[2]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// box filter a child into its quadrant (0 top left, 1 top right, 2 bottom left, 3 bottom right)
+void downsample(Pyramid *py, unsigned char *child, int quadrant, unsigned char *rgb)
+{
+	int t = py->tileSize, half = t / 2;
+	int i, j, ch, x0 = (quadrant & 1) * half, y0 = (quadrant >> 1) * half;
+	unsigned char *a, *b;
+
+	for (i = 0; i < half; i++) {
+		for (j = 0; j < half; j++) {
+			a = &child[((size_t)(2 * i) * t + 2 * j) * 3];
+			b = a + (size_t)t * 3;
+			for (ch = 0; ch < 3; ch++) {
+				rgb[((size_t)(y0 + i) * t + x0 + j) * 3 + ch] = (a[ch] + a[ch + 3] + b[ch] + b[ch + 3] + 2) / 4;
+			}
+		}
+	}
+}
+
+// depth first build of tile (z, x, y) into rgb, returns 1 if the tile is a single colour
+// tmp holds one spare tile per level below z
+int buildTile(Pyramid *py, int z, int x, int y, unsigned char *rgb, unsigned char **tmp, void *iters)
+{
+	int t = py->tileSize, q, uniform, childUniform, k;
+	size_t n, leafPixels = (size_t)t * t;
+	unsigned char first[3];
+
+	if (z == py->maxZoom) {
+		n = (size_t)y * py->leavesAcross + x;
+		if (pread(py->scratch, iters, leafPixels * py->iterBytes,
+			(off_t)(n * leafPixels * py->iterBytes)) != (ssize_t)(leafPixels * py->iterBytes)) {
+			perror("Cannot read mandel.tiles.tmp file");
+			exit(EXIT_FAILURE);
+		}
+		for (n = 0; n < leafPixels; n++) {
+			k = py->iterBytes == 2 ? ((uint16_t *)iters)[n] : ((int *)iters)[n];
+			paletteRGB(py->table[k], &rgb[n * 3]);
+		}
+		uniform = isUniform(py, rgb);
+	}
+	else {
+		uniform = 1;
+		for (q = 0; q < 4; q++) {
+			childUniform = buildTile(py, z + 1, 2 * x + (q & 1), 2 * y + (q >> 1), tmp[z + 1], tmp, iters);
+			if (q == 0) {
+				memcpy(first, tmp[z + 1], 3);
+			}
+			uniform = uniform && childUniform && memcmp(first, tmp[z + 1], 3) == 0;
+			downsample(py, tmp[z + 1], q, rgb);
+		}
+	}
+
+	writeTile(py, z, x, y, rgb, uniform);
+	return uniform;
+}
+
+// single colour tiles are encoded once and hard linked, everything else is encoded
+void writeTile(Pyramid *py, int z, int x, int y, unsigned char *rgb, int uniform)
+{
+	char path[64], shared[64];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "tiles/%d/%d/%d.png", z, x, y);
+	unlink(path);
+
+	if (uniform) {
+		snprintf(shared, sizeof(shared), "tiles/uniform_%02x%02x%02x.png", rgb[0], rgb[1], rgb[2]);
+		pthread_mutex_lock(&py->lock);
+		if (stat(shared, &st) != 0) {
+			writePNG(shared, rgb, py->tileSize, py->tileSize);
+		}
+		pthread_mutex_unlock(&py->lock);
+		if (link(shared, path) == 0) {
+			pthread_mutex_lock(&py->lock);
+			py->linked++;
+			pthread_mutex_unlock(&py->lock);
+			return;
+		}
+	}
+
+	writePNG(path, rgb, py->tileSize, py->tileSize);
+	pthread_mutex_lock(&py->lock);
+	py->written++;
+	pthread_mutex_unlock(&py->lock);
+}
+
+static void pngChunk(FILE *fp, const char *type, const unsigned char *data, uint32_t length)
+{
+	unsigned char be[4] = {length >> 24, length >> 16, length >> 8, length};
+	uLong crc = crc32(0L, (const Bytef *)type, 4);
+
+	crc = crc32(crc, data, length);
+	fwrite(be, 1, 4, fp);
+	fwrite(type, 1, 4, fp);
+	fwrite(data, 1, length, fp);
+	be[0] = crc >> 24;
+	be[1] = crc >> 16;
+	be[2] = crc >> 8;
+	be[3] = crc;
+	fwrite(be, 1, 4, fp);
+}
+
+// minimal 8-bit RGB PNG, no filtering, fastest deflate level
+void writePNG(const char *path, unsigned char *rgb, int width, int height)
+{
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	unsigned char ihdr[13] = {width >> 24, width >> 16, width >> 8, width,
+		height >> 24, height >> 16, height >> 8, height, 8, 2, 0, 0, 0};
+	size_t rowBytes = (size_t)width * 3;
+	uLongf packedSize = compressBound((height * (rowBytes + 1)));
+	unsigned char *raw, *packed;
+	FILE *fp;
+	int i;
+
+	if ((raw = malloc(height * (rowBytes + 1))) == NULL || (packed = malloc(packedSize)) == NULL) {
+		perror("Cannot allocate memory (png)");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < height; i++) {
+		raw[i * (rowBytes + 1)] = 0;
+		memcpy(&raw[i * (rowBytes + 1) + 1], &rgb[i * rowBytes], rowBytes);
+	}
+	if (compress2(packed, &packedSize, raw, height * (rowBytes + 1), Z_BEST_SPEED) != Z_OK) {
+		fprintf(stderr, "Cannot compress %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((fp = fopen(path, "wb")) == NULL) {
+		perror("Cannot open tile file");
+		exit(EXIT_FAILURE);
+	}
+	fwrite(signature, 1, 8, fp);
+	pngChunk(fp, "IHDR", ihdr, 13);
+	pngChunk(fp, "IDAT", packed, packedSize);
+	pngChunk(fp, "IEND", NULL, 0);
+	fclose(fp);
+
+	free(raw);
+	free(packed);
+}
+
+void *doWork(void *arg)
+{
+	Pyramid *py = (Pyramid *)arg;
+	Parameters *p = py->p, lp;
+	int t = py->tileSize, work, z, k, x, y;
+	size_t leafPixels = (size_t)t * t;
+	long long *histogram = NULL;
+	unsigned char **tmp = NULL;
+	uint16_t *iter16;
+
+	// a leaf is just a small frame of its own, so mandelCompute runs on it unchanged
+	lp.width = lp.height = t;
+	lp.maxIter = p->maxIter;
+	lp.step = p->step;
+	lp.pixels = NULL;
+	if ((lp.carray = malloc(leafPixels * sizeof(double complex))) == NULL ||
+		(lp.iterations = malloc(leafPixels * sizeof(int))) == NULL ||
+		(iter16 = malloc(leafPixels * sizeof(uint16_t))) == NULL) {
+		perror("Cannot allocate memory (leaf)");
+		exit(EXIT_FAILURE);
+	}
+
+	if (py->phase == COMPUTE) {
+		if ((histogram = calloc(p->maxIter, sizeof(long long))) == NULL) {
+			perror("Cannot allocate memory (histogram)");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else {
+		if ((tmp = calloc(py->maxZoom + 1, sizeof(unsigned char *))) == NULL) {
+			perror("Cannot allocate memory (tiles)");
+			exit(EXIT_FAILURE);
+		}
+		for (z = py->splitLevel + 1; z <= py->maxZoom; z++) {
+			if ((tmp[z] = malloc(leafPixels * 3)) == NULL) {
+				perror("Cannot allocate memory (tiles)");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&py->lock);
+		work = py->next++;
+		pthread_mutex_unlock(&py->lock);
+		if (work >= py->numWork) {
+			break;
+		}
+
+		if (py->phase == COMPUTE) {
+			computeLeaf(py, &lp, work % py->leavesAcross, work / py->leavesAcross, histogram, iter16);
+		}
+		else {
+			x = work % (1 << py->splitLevel);
+			y = work / (1 << py->splitLevel);
+			py->rootUniform[work] = buildTile(py, py->splitLevel, x, y, py->roots[work], tmp, lp.iterations);
+		}
+	}
+
+	if (histogram != NULL) {
+		pthread_mutex_lock(&py->lock);
+		for (k = 0; k < p->maxIter; k++) {
+			py->histogram[k] += histogram[k];
+		}
+		pthread_mutex_unlock(&py->lock);
+		free(histogram);
+	}
+	if (tmp != NULL) {
+		for (z = 0; z <= py->maxZoom; z++) {
+			free(tmp[z]);
+		}
+		free(tmp);
+	}
+	free(lp.carray);
+	free(lp.iterations);
+	free(iter16);
+	return(NULL);
+}
+
+// leaves and subtrees go to the thread pool, the few levels above the split
+// are downsampled by the main thread from the subtree roots
+void pyramidCompute(Pyramid *py)
+{
+	pthread_t *thr;
+	unsigned char **level, **parent;
+	int *uniform, *parentUniform;
+	int i, z, x, y, q, across, child, same;
+
+	if ((thr = malloc(py->p->numProcess * sizeof(pthread_t))) == NULL) {
+		perror("Cannot allocate memory (threads)");
+		exit(EXIT_FAILURE);
+	}
+
+	for (py->phase = COMPUTE; py->phase <= BUILD; py->phase++) {
+		py->next = 0;
+		py->numWork = py->phase == COMPUTE ? py->leavesAcross * py->leavesAcross : 1 << (2 * py->splitLevel);
+		for (i = 0; i < py->p->numProcess; i++) {
+			pthread_create(&thr[i], NULL, doWork, (void *)py);
+		}
+		for (i = 0; i < py->p->numProcess; i++) {
+			pthread_join(thr[i], NULL);
+		}
+		if (py->phase == COMPUTE) {
+			histogramTable(py->histogram, py->p->maxIter, py->table);
+			printf("Computed %d leaf tiles\n", py->numWork);
+		}
+	}
+	free(thr);
+
+	level = py->roots;
+	uniform = py->rootUniform;
+	for (z = py->splitLevel - 1; z >= 0; z--) {
+		across = 1 << z;
+		parent = malloc(across * across * sizeof(unsigned char *));
+		parentUniform = malloc(across * across * sizeof(int));
+		if (parent == NULL || parentUniform == NULL) {
+			perror("Cannot allocate memory (tiles)");
+			exit(EXIT_FAILURE);
+		}
+		for (y = 0; y < across; y++) {
+			for (x = 0; x < across; x++) {
+				i = y * across + x;
+				if ((parent[i] = malloc((size_t)py->tileSize * py->tileSize * 3)) == NULL) {
+					perror("Cannot allocate memory (tiles)");
+					exit(EXIT_FAILURE);
+				}
+				same = 1;
+				for (q = 0; q < 4; q++) {
+					child = (2 * y + (q >> 1)) * (2 * across) + 2 * x + (q & 1);
+					downsample(py, level[child], q, parent[i]);
+					same = same && uniform[child] && memcmp(level[child], level[(2 * y) * (2 * across) + 2 * x], 3) == 0;
+				}
+				parentUniform[i] = same;
+				writeTile(py, z, x, y, parent[i], same);
+			}
+		}
+		if (level != py->roots) {
+			for (i = 0; i < 4 * across * across; i++) {
+				free(level[i]);
+			}
+			free(level);
+			free(uniform);
+		}
+		level = parent;
+		uniform = parentUniform;
+	}
+	if (level != py->roots) {
+		free(level[0]);
+		free(level);
+		free(uniform);
+	}
+}
+
+// free all dynamic memory and close the scratch file
+void freeMemory(Pyramid *py)
+{
+	int i;
+
+	printf("	-> Freeing Memory <-\n");
+	for (i = 0; i < 1 << (2 * py->splitLevel); i++) {
+		free(py->roots[i]);
+	}
+	free(py->roots);
+	free(py->rootUniform);
+	free(py->histogram);
+	free(py->table);
+	close(py->scratch);
+	pthread_mutex_destroy(&py->lock);
+}
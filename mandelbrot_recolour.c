@@ -0,0 +1,258 @@
+// Mandelbrot set Generation
+// Colouring-only re-render from an iteration file (see mandel_iter.c)
+// Nothing is computed: the counts are loaded, coloured and encoded, so trying
+// another colouring or palette takes milliseconds instead of a render.
+//   hist     - histogram colouring, mandel.dat is byte-identical to the render's
+//   escape   - log(k + 1) / log(maxIter), as mbc and mbpipe do
+//   distance - the mbomp MANDEL_DISTANCE shading, for files saved with distances
+// "dat" writes mandel.dat for gnuplot (palette edits then only need mandel.gp),
+// "ppm" writes mandel.ppm through MANDEL_PALETTE, a list of position:rrggbb
+// stops such as 0:000000,0.5:0000ff,1:ffffff (default: the mandel.gp palette).
+// Iteration files are written by mb5, mbp and mbomp with MANDEL_SAVE_ITER=file,
+// raw or encoded (MANDEL_ITER_ENCODING=rle|zlib), and decoded block by block.
+
+// Example: MANDEL_SAVE_ITER=seahorse.iter mbomp 10000 -0.668 0.32 0.02 6
+//          mbrecolour seahorse.iter escape ppm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+
+#define DE_SCALE 64.0	// distance in pixels that shades to white, as in mbomp
+#define MAX_STOPS 32	// palette stops
+#define DD_SPLIT 134217729.0	// 2^27 + 1, as in mbomp
+
+enum{HIST, ESCAPE, DISTANCE};
+
+/* function prototypes */
+void initialise(Parameters *p, int doubleDouble);
+double ddCoord(double hi, double lo, double k, double step);
+void histogramColouring(Parameters *p);
+void escapeColouring(Parameters *p);
+void distanceColouring(Parameters *p, const float *distance);
+void writeToFile(Parameters p);
+void writePPM(Parameters p);
+void freeMemory(Parameters p);
+
+Arena arena;  // backing store for pixels and carray
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	char colour[16] = "hist", format[16] = "dat";
+	struct timespec start, end;
+	float *distance;
+	Parameters p;
+	int doubleDouble;
+
+	if (argc < 2) {
+		printf("Usage: mbrecolour file [hist|escape|distance] [dat|ppm]\n");
+		exit(EXIT_FAILURE);
+	}
+	if (argc >= 3) {
+		sscanf(argv[2], "%15s", colour);
+	}
+	if (argc >= 4) {
+		sscanf(argv[3], "%15s", format);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	distance = iterLoad(argv[1], &p, &doubleDouble);
+	p.numProcess = 1;
+	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
+
+	initialise(&p, doubleDouble);
+	if (strcmp(colour, "distance") == 0) {
+		if (distance == NULL) {
+			fprintf(stderr, "%s has no distances, render it with MANDEL_DISTANCE=1\n", argv[1]);
+			exit(EXIT_FAILURE);
+		}
+		distanceColouring(&p, distance);
+	}
+	else if (strcmp(colour, "escape") == 0) {
+		escapeColouring(&p);
+	}
+	else {
+		histogramColouring(&p);
+	}
+	if (strcmp(format, "ppm") == 0) {
+		writePPM(p);
+	}
+	else {
+		writeToFile(p);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Time used for recolouring %f\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	free(distance);
+	freeMemory(p);
+	return (0);
+}
+
+// free all dynamic memory in Parameters structure
+void freeMemory(Parameters p)
+{
+	printf("	-> Freeing Memory <-\n");
+	free(p.iterations);
+	arenaFree(&arena);
+}
+
+// high part of (hi, lo) + k * step in double-double arithmetic, the way
+// mbomp forms c for double-double views
+double ddCoord(double hi, double lo, double k, double step)
+{
+	double s, e, t, kh, kl, sh, sl, ph, pe, bb;
+
+	// s + e = k * step exactly (Dekker)
+	s = k * step;
+	t = DD_SPLIT * k;
+	kh = t - (t - k);
+	kl = k - kh;
+	t = DD_SPLIT * step;
+	sh = t - (t - step);
+	sl = step - sh;
+	e = ((kh * sh - s) + kh * sl + kl * sh) + kl * sl;
+	// ph + pe = hi + s exactly, then the low parts
+	ph = hi + s;
+	bb = ph - hi;
+	pe = (hi - (ph - bb)) + (s - bb);
+	pe += lo + e;
+	return ph + pe;
+}
+
+// pixels, and carray on the same grid as the renderers' initialise
+// (or as mbomp's ddPixel for a double-double render)
+void initialise(Parameters *p, int doubleDouble)
+{
+	int *iterations = p->iterations, i, j;
+	double x, y;
+
+	arenaAlloc(&arena, p, ARENA_PIXELS | ARENA_CARRAY);
+	p->iterations = iterations;
+
+	if (doubleDouble) {
+		for (i = 0; i < p->height; i++) {
+			y = ddCoord(p->yMax, p->yMaxLo, i, -p->step);
+			for (j = 0; j < p->width; j++) {
+				p->carray[i * p->width + j] = ddCoord(p->xMin, p->xMinLo, j, p->step) + y * I;
+			}
+		}
+		return;
+	}
+	for (i = 0; i < p->height; i++) {
+		y = gridY(p->yMax, p->step, i);
+		x = p->xMin;
+		for (j = 0; j < p->width; j++) {
+			p->carray[i * p->width + j] = x + y * I;
+			x += p->step;
+		}
+	}
+}
+
+// compute the colour for each pixel using histogram algorithm
+void histogramColouring(Parameters *p)
+{
+	long long *histogram;
+	double *table;
+	int n;
+
+	if ((histogram = calloc(p->maxIter, sizeof(long long))) == NULL || (table = malloc(p->maxIter * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+	for (n = 0; n < p->width * p->height; n++) {
+		histogram[p->iterations[n]]++;
+	}
+	histogramTable(histogram, p->maxIter, table);
+	for (n = 0; n < p->width * p->height; n++) {
+		p->pixels[n] = table[p->iterations[n]];
+	}
+	free(histogram);
+	free(table);
+}
+
+// log scaled escape time, 0 in the set
+void escapeColouring(Parameters *p)
+{
+	int n, k;
+
+	for (n = 0; n < p->width * p->height; n++) {
+		k = p->iterations[n];
+		p->pixels[n] = k == p->maxIter - 1 ? 0.0 : log(k + 1) / log(p->maxIter);
+	}
+}
+
+// dark at the boundary and in the set, white DE_SCALE pixels away
+void distanceColouring(Parameters *p, const float *distance)
+{
+	int n;
+
+	for (n = 0; n < p->width * p->height; n++) {
+		p->pixels[n] = pow(fmin(distance[n] / DE_SCALE, 1.0), 0.25);
+	}
+}
+
+// write coordinates and values to file for gnuplot
+void writeToFile(Parameters p)
+{
+	writeDat(p, "mandel.dat");
+}
+
+// 8-bit RGB through MANDEL_PALETTE, or the mandel.gp palette
+void writePPM(Parameters p)
+{
+	char *env = getenv("MANDEL_PALETTE"), *spec;
+	double position[MAX_STOPS], t;
+	unsigned char stop[MAX_STOPS][3], *rgb;
+	unsigned int hex;
+	int numStops = 0, n, s, c;
+	FILE *fp;
+
+	for (spec = env; spec != NULL && *spec != '\0' && numStops < MAX_STOPS; spec += strcspn(spec, ",")) {
+		spec += *spec == ',';
+		if (sscanf(spec, "%lf:%6x", &position[numStops], &hex) != 2) {
+			fprintf(stderr, "MANDEL_PALETTE stops must be position:rrggbb\n");
+			exit(EXIT_FAILURE);
+		}
+		stop[numStops][0] = hex >> 16;
+		stop[numStops][1] = (hex >> 8) & 0xff;
+		stop[numStops][2] = hex & 0xff;
+		numStops++;
+	}
+
+	if ((rgb = malloc((size_t)p.width * p.height * 3)) == NULL) {
+		perror("Cannot allocate memory (image)");
+		exit(EXIT_FAILURE);
+	}
+	for (n = 0; n < p.width * p.height; n++) {
+		if (numStops == 0) {
+			paletteRGB(p.pixels[n], &rgb[n * 3]);
+			continue;
+		}
+		for (s = 0; s < numStops - 1 && p.pixels[n] > position[s + 1]; s++);
+		if (s == numStops - 1 || p.pixels[n] <= position[s]) {
+			memcpy(&rgb[n * 3], stop[s], 3);
+			continue;
+		}
+		t = (p.pixels[n] - position[s]) / (position[s + 1] - position[s]);
+		for (c = 0; c < 3; c++) {
+			rgb[n * 3 + c] = (unsigned char)(stop[s][c] + (stop[s + 1][c] - stop[s][c]) * t + 0.5);
+		}
+	}
+
+	if ((fp = fopen("mandel.ppm", "wb")) == NULL) {
+		perror("Cannot open mandel.ppm file");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "P6\n%d %d\n255\n", p.width, p.height);
+	if (fwrite(rgb, 3, (size_t)p.width * p.height, fp) != (size_t)p.width * p.height) {
+		perror("Cannot write mandel.ppm file");
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+	free(rgb);
+}
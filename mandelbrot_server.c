@@ -0,0 +1,519 @@
+// Mandelbrot set Generation
+// Long-running render server with a prioritised request queue
+// A fixed pool of worker threads and a cache of iteration buffers stay warm
+// between requests. Each request is split into bands, workers always take the
+// next band of the cheapest queued render, so small previews overtake large
+// renders already in progress. The worker that finishes the last band of a
+// render colours it and streams the result back over the connection.
+//
+// Buffers come from render-context arenas (mandel_arena.c), so MANDEL_HUGEPAGES
+// applies to them as well.
+//
+// Listens on a Unix-domain socket (default mandel.sock) or, when given a port
+// number, on 127.0.0.1:port. One request per connection, a single line:
+//   maxIter x y size width height [hist|escape] [ppm|dat|iter]
+// Replies with the raw result (PPM image, gnuplot text as in mandel.dat, or
+// "width height maxIter\n" followed by int iteration counts), or "ERR ...\n".
+
+// Example: ./mbserver 6 & printf '1000 -0.668 0.32 0.02 256 256\n' | socat - UNIX-CONNECT:mandel.sock > view.ppm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SOCKET_PATH "mandel.sock"
+#define BAND_ROWS 16	// rows handed to a worker at a time
+#define MAX_SIZE 20000	// largest width or height accepted
+#define SPARE_BUFFERS 8	// arenas kept for reuse
+#define MAX_COORD 1e6	// largest |x|, |y| or size accepted
+#define REQUEST_TIMEOUT 5000	// milliseconds a client has to send its request line
+#define SEND_TIMEOUT 5	// seconds a reply may stall before the client is dropped
+#define MAX_ITER 10000000	// largest maxIter accepted
+#define TEXT_BYTES 65536	// gnuplot text sent per chunk
+#define LINE_BYTES 3 * 330	// worst case of three "%.12lf" fields
+
+enum{HIST, ESCAPE};
+enum{PPM, DAT, ITER};
+
+typedef struct Job {
+	Parameters p;
+	int fd;  // client connection
+	int colour, format;
+	long long cost;  // pixels, cheaper renders are served first
+	unsigned long seq;  // arrival order, breaks ties
+	int numBands;
+	int nextBand;  // next band to hand out
+	int bandsDone;
+	Arena arena;  // backing store for iterations, recycled between jobs
+	struct Job *next;
+} Job;
+
+typedef struct {
+	Job *queue;  // jobs with bands left to hand out, sorted by cost then seq
+	unsigned long seq;
+	Arena spare[SPARE_BUFFERS];  // arenas of finished jobs waiting for reuse
+	int numWorkers;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} Server;
+
+Server server = {NULL, 0, {{NULL}}, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+/* function prototypes */
+int openListener(const char *where);
+int readRequest(int fd, Job *job);
+void *readConnection(void *arg);
+void submitJob(Job *job);
+void *doWork(void *arg);
+void computeBand(Job *job, int band);
+void finishJob(Job *job);
+void takeArena(Job *job);
+void giveArena(Arena *a);
+int sendAll(int fd, const void *buf, size_t count);
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	int numThreads = 2, listener, fd, i;
+	const char *where = SOCKET_PATH;
+	struct timeval sendTimeout = {SEND_TIMEOUT, 0};
+	pthread_t thr;
+	Job *job;
+
+	if (argc < 2) {
+		printf("Usage: mbserver numThreads [socketPath | port]\n\nUsing default values\n");
+	}
+	if (argc >= 2) {
+		sscanf(argv[1], "%i", &numThreads);
+	}
+	if (argc >= 3) {
+		where = argv[2];
+	}
+
+	setvbuf(stdout, NULL, _IOLBF, 0);  // log lines show up as they happen
+	signal(SIGPIPE, SIG_IGN);  // a client hanging up must not take the server down
+	listener = openListener(where);
+
+	server.numWorkers = numThreads;
+	for (i = 0; i < numThreads; i++) {
+		pthread_create(&thr, NULL, doWork, NULL);
+		pthread_detach(thr);
+	}
+	printf("Listening on %s with %d workers\n", where, numThreads);
+
+	for (;;) {
+		if ((fd = accept(listener, NULL, NULL)) < 0) {
+			if (errno != EINTR) {
+				perror("accept");
+			}
+			continue;
+		}
+		// replies are written from pool workers, a client that stops reading must not hold one
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+		if ((job = malloc(sizeof(Job))) == NULL) {
+			perror("Cannot allocate memory (job)");
+			close(fd);
+			continue;
+		}
+		job->fd = fd;
+		if (pthread_create(&thr, NULL, readConnection, job) != 0) {
+			perror("Cannot create reader thread");
+			close(fd);
+			free(job);
+			continue;
+		}
+		pthread_detach(thr);
+	}
+
+	return (0);
+}
+
+// a bare port number means local TCP, anything else is a Unix-domain socket path
+int openListener(const char *where)
+{
+	struct sockaddr_un un;
+	struct sockaddr_in in;
+	int fd, port, one = 1;
+	char *end;
+
+	port = (int)strtol(where, &end, 10);
+	if (*where != '\0' && *end == '\0') {
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+			perror("Socket error");
+			exit(EXIT_FAILURE);
+		}
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_port = htons(port);
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (bind(fd, (struct sockaddr *)&in, sizeof(in)) != 0) {
+			perror("Cannot bind port");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else {
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+			perror("Socket error");
+			exit(EXIT_FAILURE);
+		}
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strncpy(un.sun_path, where, sizeof(un.sun_path) - 1);
+		unlink(where);
+		if (bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0) {
+			perror("Cannot bind socket");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (listen(fd, 64) != 0) {
+		perror("Cannot listen");
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+// read and queue the request of one connection (job->fd) off the accept
+// thread, so a slow or silent client only holds up itself
+void *readConnection(void *arg)
+{
+	Job *job = (Job *)arg;
+	int fd = job->fd;
+
+	if (readRequest(fd, job) != 0) {
+		close(fd);
+		free(job);
+	}
+	else {
+		submitJob(job);
+	}
+	return(NULL);
+}
+
+// parse the request line into a job, replies with ERR and returns -1 on bad
+// input or when the line does not arrive within REQUEST_TIMEOUT
+int readRequest(int fd, Job *job)
+{
+	char line[256], colour[16] = "hist", format[16] = "ppm";
+	const char *error = NULL;
+	struct pollfd pfd = {fd, POLLIN, 0};
+	struct timespec start, now;
+	double xc, yc, size;
+	int n = 0, fields, wait;
+	ssize_t got;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (n < (int)sizeof(line) - 1 && memchr(line, '\n', n) == NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		wait = REQUEST_TIMEOUT - (int)((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+		if (wait <= 0) {
+			error = "ERR request timed out\n";
+			sendAll(fd, error, strlen(error));
+			return -1;
+		}
+		if (poll(&pfd, 1, wait) < 0 && errno != EINTR) {
+			return -1;
+		}
+		if (pfd.revents == 0) {
+			continue;
+		}
+		if ((got = read(fd, &line[n], sizeof(line) - 1 - n)) < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			break;  // the client closed early, parse what arrived
+		}
+		n += got;
+	}
+	line[n] = '\0';
+	line[strcspn(line, "\n")] = '\0';
+
+	memset(job, 0, sizeof(Job));
+	fields = sscanf(line, "%i %lf %lf %lf %i %i %15s %15s", &job->p.maxIter, &xc, &yc, &size,
+		&job->p.width, &job->p.height, colour, format);
+
+	if (fields < 6) {
+		error = "ERR expected: maxIter x y size width height [hist|escape] [ppm|dat|iter]\n";
+	}
+	else if (job->p.maxIter < 1 || job->p.maxIter > MAX_ITER || job->p.width < 1 || job->p.height < 1 ||
+		job->p.width > MAX_SIZE || job->p.height > MAX_SIZE || !(size > 0 && size <= MAX_COORD) ||
+		!(fabs(xc) <= MAX_COORD) || !(fabs(yc) <= MAX_COORD)) {
+		error = "ERR parameters out of range\n";
+	}
+	if (error != NULL) {
+		sendAll(fd, error, strlen(error));
+		return -1;
+	}
+
+	size = size / 2;
+	job->p.xMin = xc - size;
+	job->p.yMin = yc - size;
+	job->p.xMax = xc + size;
+	job->p.yMax = yc + size;
+	job->p.step = (job->p.yMax - job->p.yMin) / job->p.width;
+	job->fd = fd;
+	job->colour = strcmp(colour, "escape") == 0 ? ESCAPE : HIST;
+	job->format = strcmp(format, "dat") == 0 ? DAT : (strcmp(format, "iter") == 0 ? ITER : PPM);
+	job->cost = (long long)job->p.width * job->p.height;
+	job->numBands = (job->p.height + BAND_ROWS - 1) / BAND_ROWS;
+	return 0;
+}
+
+// queue a job by cost, its arena comes from the spare cache when one is big enough
+void submitJob(Job *job)
+{
+	Job **pos;
+
+	pthread_mutex_lock(&server.lock);
+	takeArena(job);
+	job->seq = server.seq++;
+	printf("Queued %d x %d render #%lu, maxIter %d\n", job->p.width, job->p.height, job->seq, job->p.maxIter);
+	for (pos = &server.queue; *pos != NULL && (*pos)->cost <= job->cost; pos = &(*pos)->next) {
+	}
+	job->next = *pos;
+	*pos = job;
+	pthread_cond_signal(&server.cond);
+	pthread_mutex_unlock(&server.lock);
+}
+
+// smallest cached arena that fits without remapping, else the largest one to
+// grow, else a fresh one; called with the lock held
+void takeArena(Job *job)
+{
+	size_t need = (size_t)job->p.width * job->p.height * sizeof(int);
+	int best = -1, i;
+
+	for (i = 0; i < SPARE_BUFFERS; i++) {
+		if (server.spare[i].base == NULL) {
+			continue;
+		}
+		if (best < 0 ||
+			(server.spare[i].size >= need && (server.spare[best].size < need || server.spare[i].size < server.spare[best].size)) ||
+			(server.spare[i].size < need && server.spare[best].size < need && server.spare[i].size > server.spare[best].size)) {
+			best = i;
+		}
+	}
+	if (best >= 0) {
+		job->arena = server.spare[best];
+		server.spare[best].base = NULL;
+	}
+	arenaAlloc(&job->arena, &job->p, ARENA_ITERATIONS);
+}
+
+// keep the arena for the next request, evicting the smallest cached one if full
+void giveArena(Arena *a)
+{
+	int slot = 0, i;
+	Arena evicted = {NULL};
+
+	pthread_mutex_lock(&server.lock);
+	for (i = 0; i < SPARE_BUFFERS; i++) {
+		if (server.spare[i].base == NULL) {
+			slot = i;
+			break;
+		}
+		if (server.spare[i].size < server.spare[slot].size) {
+			slot = i;
+		}
+	}
+	if (server.spare[slot].base == NULL || server.spare[slot].size < a->size) {
+		evicted = server.spare[slot];
+		server.spare[slot] = *a;
+	}
+	else {
+		evicted = *a;
+	}
+	pthread_mutex_unlock(&server.lock);
+	arenaFree(&evicted);
+}
+
+// workers live for the whole server, always serving the head of the queue
+void *doWork(void *arg)
+{
+	Job *job;
+	int band, done;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&server.lock);
+		while (server.queue == NULL) {
+			pthread_cond_wait(&server.cond, &server.lock);
+		}
+		job = server.queue;
+		band = job->nextBand++;
+		if (job->nextBand == job->numBands) {
+			server.queue = job->next;  // nothing left to hand out, in-flight bands still finish
+		}
+		pthread_mutex_unlock(&server.lock);
+
+		computeBand(job, band);
+
+		pthread_mutex_lock(&server.lock);
+		done = ++job->bandsDone == job->numBands;
+		pthread_mutex_unlock(&server.lock);
+		if (done) {
+			finishJob(job);
+		}
+	}
+	return(NULL);
+}
+
+// test each point of one band, c is generated on the same grid as initialise (gridY)
+void computeBand(Job *job, int band)
+{
+	Parameters *p = &job->p;
+	double complex c, z;
+	double x, y;
+	int i, j, k;
+	int end = (band + 1) * BAND_ROWS < p->height ? (band + 1) * BAND_ROWS : p->height;
+
+	for (i = band * BAND_ROWS; i < end; i++) {
+		y = gridY(p->yMax, p->step, i);
+		x = p->xMin;
+		for (j = 0; j < p->width; j++) {
+			c = x + y * I;
+			z = 0 + 0 * I;
+			for (k = 0; k < p->maxIter; k++) {
+				z = z * z + c;
+				if (cabs(z) > 2.0) {
+					break;
+				}
+			}
+			p->iterations[i * p->width + j] = k >= p->maxIter ? p->maxIter - 1 : k;
+			x += p->step;
+		}
+	}
+}
+
+int sendAll(int fd, const void *buf, size_t count)
+{
+	ssize_t n;
+
+	while (count > 0) {
+		if ((n = write(fd, buf, count)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf = (const char *)buf + n;
+		count -= n;
+	}
+	return 0;
+}
+
+// colour and stream the finished frame back a band at a time, then recycle its buffer
+void finishJob(Job *job)
+{
+	Parameters *p = &job->p;
+	size_t n, numPixels = (size_t)p->width * p->height;
+	long long *histogram = NULL;
+	double *table = NULL, value, x, y;
+	unsigned char *rgb = NULL;
+	char *text = NULL, header[64];
+	const char *error = NULL;
+	int i, j, k, len, ok = 1;
+
+	// take every buffer up front so a failure can still be answered with ERR
+	if (job->format != ITER && job->colour == HIST) {
+		histogram = calloc(p->maxIter, sizeof(long long));
+		table = malloc(p->maxIter * sizeof(double));
+		if (histogram == NULL || table == NULL) {
+			error = "ERR out of memory\n";
+		}
+	}
+	if (job->format == PPM && (rgb = malloc((size_t)BAND_ROWS * p->width * 3)) == NULL) {
+		error = "ERR out of memory\n";
+	}
+	if (job->format == DAT && (text = malloc(TEXT_BYTES)) == NULL) {
+		error = "ERR out of memory\n";
+	}
+
+	if (error == NULL && histogram != NULL) {
+		for (n = 0; n < numPixels; n++) {
+			histogram[p->iterations[n]]++;
+		}
+		histogramTable(histogram, p->maxIter, table);
+	}
+
+	if (error != NULL) {
+		perror("Cannot allocate memory (reply)");
+		sendAll(job->fd, error, strlen(error));
+	}
+	else if (job->format == ITER) {
+		len = snprintf(header, sizeof(header), "%d %d %d\n", p->width, p->height, p->maxIter);
+		ok = sendAll(job->fd, header, len) == 0 &&
+			sendAll(job->fd, p->iterations, numPixels * sizeof(int)) == 0;
+	}
+	else if (job->format == PPM) {
+		len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", p->width, p->height);
+		ok = sendAll(job->fd, header, len) == 0;
+		for (i = 0; ok && i < p->height; i += BAND_ROWS) {
+			for (n = 0; n < (size_t)BAND_ROWS * p->width && i * (size_t)p->width + n < numPixels; n++) {
+				k = p->iterations[i * (size_t)p->width + n];
+				value = job->colour == HIST ? table[k] :
+					(k == p->maxIter - 1 ? 0.0 : log(k + 1) / log(p->maxIter));
+				paletteRGB(value, &rgb[n * 3]);
+			}
+			ok = sendAll(job->fd, rgb, n * 3) == 0;
+		}
+	}
+	else {
+		// same layout as writeToFile, sent whenever the next line might not fit
+		len = 0;
+		for (i = 0; ok && i < p->height; i++) {
+			y = gridY(p->yMax, p->step, i);
+			x = p->xMin;
+			for (j = 0; ok && j < p->width; j++) {
+				k = p->iterations[i * p->width + j];
+				value = job->colour == HIST ? table[k] :
+					(k == p->maxIter - 1 ? 0.0 : log(k + 1) / log(p->maxIter));
+				if (len > TEXT_BYTES - LINE_BYTES - 2) {
+					ok = sendAll(job->fd, text, len) == 0;
+					len = 0;
+				}
+				len += formatFixed(&text[len], x);
+				text[len++] = ' ';
+				len += formatFixed(&text[len], y);
+				text[len++] = ' ';
+				len += formatFixed(&text[len], value);
+				text[len++] = '\n';
+				x += p->step;
+			}
+			text[len++] = '\n';
+		}
+		ok = ok && sendAll(job->fd, text, len) == 0;
+	}
+
+	if (error != NULL) {
+		fprintf(stderr, "Render #%lu: not sent\n", job->seq);
+	}
+	else if (!ok) {
+		fprintf(stderr, "Render #%lu: client went away\n", job->seq);
+	}
+	else {
+		printf("Finished render #%lu\n", job->seq);
+	}
+	close(job->fd);
+	giveArena(&job->arena);
+	free(histogram);
+	free(table);
+	free(rgb);
+	free(text);
+	free(job);
+}
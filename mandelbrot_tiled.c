@@ -0,0 +1,392 @@
+// Mandelbrot set Generation
+// Out-of-core tiled rendering into a single tiled BigTIFF
+// The frame is never held in memory, each thread works on one tile at a time:
+//   pass 1 - compute a tile, spill its iteration counts to a scratch file and
+//            add it to the thread's histogram
+//   pass 2 - read the tile back, colour it with the global histogram and
+//            write it into its slot of the TIFF
+// Peak memory is numThreads * (tile + histogram), independent of image size.
+
+// Example coordinates: mbt 10000 -0.668 0.32 0.002 6 100000 100000 256
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define TILE_SIZE 256	// default tile edge in pixels, TIFF wants a multiple of 16
+#define TIFF_DATA 4096	// alignment of the first tile in the TIFF
+
+enum{COMPUTE, COLOUR};
+
+typedef struct {
+	Parameters *p;
+	int tileSize;
+	int tilesAcross, tilesDown, numTiles;
+	int iterBytes;  // 2 when maxIter < 65536, 4 otherwise
+	int scratch;  // file descriptor of the iteration spill file
+	int tiff;  // file descriptor of the output image
+	off_t tiffData;  // offset of tile 0 in the TIFF
+	long long *histogram;  // global histogram, dim: maxIter
+	double *table;  // colour value for each iteration count, dim: maxIter
+	int phase;
+	int nextTile;
+	int tilesDone;
+	pthread_mutex_t lock;
+} Tiled;
+
+/* function prototypes */
+void initialise(Parameters *p, Tiled *t);
+void tiledCompute(Tiled *t);
+void *doWork(void *arg);
+void computeTile(Tiled *t, int tile, void *iters, long long *histogram);
+void colourTile(Tiled *t, int tile, void *iters, unsigned char *rgb);
+void writeTiffHeader(Tiled *t);
+void writeFully(int fd, const void *buf, size_t count, off_t offset);
+void readFully(int fd, void *buf, size_t count, off_t offset);
+void freeMemory(Tiled *t);
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	int maxIter, numThreads = 2;
+	double xc, yc, size;
+	Parameters p;
+	Tiled t;
+
+	p.width = WIDTH;
+	p.height = HEIGHT;
+	t.tileSize = TILE_SIZE;
+
+	if (argc < 2) {
+		printf("Usage: mandelbrot maxIter [x y size numThreads [width height [tileSize]]]\n\nUsing default values\n");
+		maxIter = 5000;
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc == 2) {
+		sscanf(argv[1], "%i", &maxIter);
+		p.xMin = p.yMin = -2;
+		p.xMax = p.yMax = 2;
+	}
+	else if (argc >= 6) {
+		sscanf(argv[1], "%i", &maxIter);
+		sscanf(argv[2], "%lf", &xc);
+		sscanf(argv[3], "%lf", &yc);
+		sscanf(argv[4], "%lf", &size);
+		sscanf(argv[5], "%i", &numThreads);
+		if (argc >= 8) {
+			sscanf(argv[6], "%i", &p.width);
+			sscanf(argv[7], "%i", &p.height);
+		}
+		if (argc >= 9) {
+			// TIFF tiles are multiples of 16 and at most a SHORT wide
+			if (sscanf(argv[8], "%i", &t.tileSize) != 1 || t.tileSize < 1 || t.tileSize > 65520) {
+				printf("Usage: mandelbrot maxIter [x y size numThreads [width height [tileSize]]]\n\ntileSize must be 1 to 65520\n");
+				exit(EXIT_FAILURE);
+			}
+			t.tileSize = (t.tileSize + 15) / 16 * 16;
+		}
+
+		size = size / 2;
+		p.xMin = xc - size;
+		p.yMin = yc - size;
+		p.xMax = xc + size;
+		p.yMax = yc + size;
+	}
+
+	p.maxIter = maxIter;
+	p.numProcess = numThreads;
+
+	printf("xMin = %lf\nxMax = %lf\nyMin = %lf\nyMax = %lf\nMaximum iterations = %i\n", p.xMin, p.xMax, p.yMin, p.yMax, p.maxIter);
+
+	initialise(&p, &t);
+	tiledCompute(&t);
+	freeMemory(&t);
+
+	return (0);
+}
+
+// open the scratch and output files and lay out the TIFF
+void initialise(Parameters *p, Tiled *t)
+{
+	size_t tileMemory;
+
+	p->step = (p->yMax - p->yMin) / p->width;
+	p->carray = NULL;
+	p->pixels = NULL;
+	p->iterations = NULL;
+	p->histogram = NULL;
+
+	t->p = p;
+	t->tilesAcross = (p->width + t->tileSize - 1) / t->tileSize;
+	t->tilesDown = (p->height + t->tileSize - 1) / t->tileSize;
+	t->numTiles = t->tilesAcross * t->tilesDown;
+	t->iterBytes = p->maxIter < 65536 ? 2 : 4;
+
+	if ((t->histogram = calloc(p->maxIter, sizeof(long long))) == NULL ||
+		(t->table = malloc(p->maxIter * sizeof(double))) == NULL) {
+		perror("Cannot allocate memory (histogram)");
+		exit(EXIT_FAILURE);
+	}
+
+	// the scratch file is unlinked straight away so it disappears with the process
+	if ((t->scratch = open("mandel.tiles.tmp", O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+		perror("Cannot open mandel.tiles.tmp file");
+		exit(EXIT_FAILURE);
+	}
+	unlink("mandel.tiles.tmp");
+
+	if ((t->tiff = open("mandel.tif", O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror("Cannot open mandel.tif file");
+		exit(EXIT_FAILURE);
+	}
+	writeTiffHeader(t);
+
+	tileMemory = (size_t)t->tileSize * t->tileSize * (t->iterBytes + 3) + p->maxIter * sizeof(long long);
+	printf("Image %d x %d in %d tiles of %d, peak buffer memory %.1f MB\n", p->width, p->height,
+		t->numTiles, t->tileSize, (double)(tileMemory * p->numProcess) / (1024 * 1024));
+
+	pthread_mutex_init(&t->lock, NULL);
+}
+
+// BigTIFF with one IFD, 8-bit RGB, uncompressed fixed size tiles so every
+// thread can pwrite its tile without coordinating with the others
+void writeTiffHeader(Tiled *t)
+{
+	unsigned char ifd[8 + 11 * 20 + 8];
+	unsigned char header[16] = {'I', 'I', 43, 0, 8, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0};
+	uint64_t tileBytes = (uint64_t)t->tileSize * t->tileSize * 3;
+	uint64_t offsetsAt = 16 + sizeof(ifd);
+	uint64_t countsAt = offsetsAt + (uint64_t)t->numTiles * 8;
+	uint64_t *table;
+	unsigned char *e;
+	int i, n = 0;
+
+	t->tiffData = (off_t)((countsAt + (uint64_t)t->numTiles * 8 + TIFF_DATA - 1) / TIFF_DATA * TIFF_DATA);
+
+	// entry: tag, type, count, value (little endian, value left justified)
+	#define TIFF_ENTRY(tag, type, count, value) do { \
+		e = &ifd[8 + n++ * 20]; \
+		memset(e, 0, 20); \
+		e[0] = (tag) & 0xff; e[1] = (tag) >> 8; \
+		e[2] = (type); \
+		for (i = 0; i < 8; i++) e[4 + i] = (uint64_t)(count) >> (8 * i); \
+		for (i = 0; i < 8; i++) e[12 + i] = (uint64_t)(value) >> (8 * i); \
+	} while (0)
+
+	memset(ifd, 0, sizeof(ifd));
+	ifd[0] = 11;
+	TIFF_ENTRY(256, 4, 1, t->p->width);  // ImageWidth
+	TIFF_ENTRY(257, 4, 1, t->p->height);  // ImageLength
+	TIFF_ENTRY(258, 3, 3, 8 | (8ULL << 16) | (8ULL << 32));  // BitsPerSample
+	TIFF_ENTRY(259, 3, 1, 1);  // Compression: none
+	TIFF_ENTRY(262, 3, 1, 2);  // PhotometricInterpretation: RGB
+	TIFF_ENTRY(277, 3, 1, 3);  // SamplesPerPixel
+	TIFF_ENTRY(284, 3, 1, 1);  // PlanarConfiguration: contiguous
+	TIFF_ENTRY(322, 3, 1, t->tileSize);  // TileWidth
+	TIFF_ENTRY(323, 3, 1, t->tileSize);  // TileLength
+	TIFF_ENTRY(324, 16, t->numTiles, t->numTiles == 1 ? (uint64_t)t->tiffData : offsetsAt);  // TileOffsets
+	TIFF_ENTRY(325, 16, t->numTiles, t->numTiles == 1 ? tileBytes : countsAt);  // TileByteCounts
+	#undef TIFF_ENTRY
+
+	writeFully(t->tiff, header, sizeof(header), 0);
+	writeFully(t->tiff, ifd, sizeof(ifd), 16);
+
+	if ((table = malloc(t->numTiles * sizeof(uint64_t))) == NULL) {
+		perror("Cannot allocate memory (tile table)");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < t->numTiles; i++) {
+		table[i] = (uint64_t)t->tiffData + (uint64_t)i * tileBytes;
+	}
+	writeFully(t->tiff, table, t->numTiles * sizeof(uint64_t), (off_t)offsetsAt);
+	for (i = 0; i < t->numTiles; i++) {
+		table[i] = tileBytes;
+	}
+	writeFully(t->tiff, table, t->numTiles * sizeof(uint64_t), (off_t)countsAt);
+	free(table);
+}
+
+void writeFully(int fd, const void *buf, size_t count, off_t offset)
+{
+	ssize_t n;
+
+	while (count > 0) {
+		if ((n = pwrite(fd, buf, count, offset)) <= 0) {
+			perror("Cannot write tile");
+			exit(EXIT_FAILURE);
+		}
+		buf = (const char *)buf + n;
+		count -= n;
+		offset += n;
+	}
+}
+
+void readFully(int fd, void *buf, size_t count, off_t offset)
+{
+	ssize_t n;
+
+	while (count > 0) {
+		if ((n = pread(fd, buf, count, offset)) <= 0) {
+			perror("Cannot read tile");
+			exit(EXIT_FAILURE);
+		}
+		buf = (char *)buf + n;
+		count -= n;
+		offset += n;
+	}
+}
+
+// compute one tile and spill it, pixels outside the image are left out of the histogram
+void computeTile(Tiled *t, int tile, void *iters, long long *histogram)
+{
+	Parameters *p = t->p;
+	int x0 = (tile % t->tilesAcross) * t->tileSize;
+	int y0 = (tile / t->tilesAcross) * t->tileSize;
+	int i, j, k;
+	double complex c, z;
+	size_t idx, tilePixels = (size_t)t->tileSize * t->tileSize;
+
+	for (i = 0; i < t->tileSize; i++) {
+		for (j = 0; j < t->tileSize; j++) {
+			idx = (size_t)i * t->tileSize + j;
+			k = p->maxIter - 1;
+			if (y0 + i < p->height && x0 + j < p->width) {
+				// coordinates by multiplication rather than accumulation, no per-row state
+				c = (p->xMin + (x0 + j) * p->step) + (p->yMax - (y0 + i) * p->step) * I;
+				z = 0 + 0 * I;
+				for (k = 0; k < p->maxIter; k++) {
+					z = z * z + c;
+					if (cabs(z) > 2.0) {
+						break;
+					}
+				}
+				if (k >= p->maxIter) {
+					k = p->maxIter - 1;
+				}
+				histogram[k]++;
+			}
+			if (t->iterBytes == 2) {
+				((uint16_t *)iters)[idx] = (uint16_t)k;
+			}
+			else {
+				((int *)iters)[idx] = k;
+			}
+		}
+	}
+	writeFully(t->scratch, iters, tilePixels * t->iterBytes, (off_t)tile * tilePixels * t->iterBytes);
+}
+
+// read a tile back, colour it and drop it into its slot in the TIFF
+void colourTile(Tiled *t, int tile, void *iters, unsigned char *rgb)
+{
+	size_t idx, tilePixels = (size_t)t->tileSize * t->tileSize;
+	int k;
+
+	readFully(t->scratch, iters, tilePixels * t->iterBytes, (off_t)tile * tilePixels * t->iterBytes);
+	for (idx = 0; idx < tilePixels; idx++) {
+		k = t->iterBytes == 2 ? ((uint16_t *)iters)[idx] : ((int *)iters)[idx];
+		paletteRGB(t->table[k], &rgb[idx * 3]);
+	}
+	writeFully(t->tiff, rgb, tilePixels * 3, t->tiffData + (off_t)tile * tilePixels * 3);
+}
+
+void *doWork(void *arg)
+{
+	Tiled *t = (Tiled *)arg;
+	size_t tilePixels = (size_t)t->tileSize * t->tileSize;
+	long long *histogram = NULL;
+	unsigned char *rgb = NULL;
+	void *iters;
+	int tile, done, k;
+
+	if ((iters = malloc(tilePixels * t->iterBytes)) == NULL ||
+		(t->phase == COMPUTE && (histogram = calloc(t->p->maxIter, sizeof(long long))) == NULL) ||
+		(t->phase == COLOUR && (rgb = malloc(tilePixels * 3)) == NULL)) {
+		perror("Cannot allocate memory (tile)");
+		exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&t->lock);
+		tile = t->nextTile++;
+		pthread_mutex_unlock(&t->lock);
+		if (tile >= t->numTiles) {
+			break;
+		}
+
+		if (t->phase == COMPUTE) {
+			computeTile(t, tile, iters, histogram);
+		}
+		else {
+			colourTile(t, tile, iters, rgb);
+		}
+
+		pthread_mutex_lock(&t->lock);
+		done = ++t->tilesDone;
+		pthread_mutex_unlock(&t->lock);
+		if (done % (t->numTiles / 10 + 1) == 0) {
+			printf("%s %d of %d tiles\n", t->phase == COMPUTE ? "Computed" : "Coloured", done, t->numTiles);
+		}
+	}
+
+	if (histogram != NULL) {
+		pthread_mutex_lock(&t->lock);
+		for (k = 0; k < t->p->maxIter; k++) {
+			t->histogram[k] += histogram[k];
+		}
+		pthread_mutex_unlock(&t->lock);
+	}
+	free(histogram);
+	free(rgb);
+	free(iters);
+	return(NULL);
+}
+
+// two passes over the tiles, the global histogram is built between them
+void tiledCompute(Tiled *t)
+{
+	pthread_t *thr;
+	int i, phase;
+
+	if ((thr = malloc(t->p->numProcess * sizeof(pthread_t))) == NULL) {
+		perror("Cannot allocate memory (threads)");
+		exit(EXIT_FAILURE);
+	}
+
+	for (phase = COMPUTE; phase <= COLOUR; phase++) {
+		t->phase = phase;
+		t->nextTile = 0;
+		t->tilesDone = 0;
+		for (i = 0; i < t->p->numProcess; i++) {
+			pthread_create(&thr[i], NULL, doWork, (void *)t);
+		}
+		for (i = 0; i < t->p->numProcess; i++) {
+			pthread_join(thr[i], NULL);
+		}
+		if (phase == COMPUTE) {
+			histogramTable(t->histogram, t->p->maxIter, t->table);
+		}
+	}
+	printf("Threads Joined\n");
+	free(thr);
+}
+
+// free all dynamic memory and close the files
+void freeMemory(Tiled *t)
+{
+	printf("	-> Freeing Memory <-\n");
+	close(t->scratch);
+	close(t->tiff);
+	free(t->histogram);
+	free(t->table);
+	pthread_mutex_destroy(&t->lock);
+}
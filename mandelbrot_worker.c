@@ -0,0 +1,58 @@
+// Mandelbrot set Generation
+// Worker for a shared render context (see mandel_shared.c)
+// Attaches to a render started with MANDEL_SHARED=/name and computes its tiles
+// alongside the render's own children until none are left, then exits. The
+// render need not be running yet: the worker waits up to WAIT_SECONDS for it.
+
+// Example: MANDEL_SHARED=/mandel ./mbfs 10000 -0.668 0.32 0.02 2 &
+//          ./mbworker /mandel 4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <complex.h>
+#include <time.h>
+#include "mandel.h"
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define WAIT_SECONDS 10	// how long to wait for the render to appear
+
+/* main program – execution begins here */
+int main(int argc, char *argv[])
+{
+	SharedRender s;
+	int numProcess = 1, tries, i, tiles;
+
+	if (argc < 2 || argv[1][0] != '/') {
+		printf("Usage: mbworker /name [numProcess]\n");
+		exit(EXIT_FAILURE);
+	}
+	if (argc >= 3) {
+		sscanf(argv[2], "%i", &numProcess);
+	}
+
+	for (tries = 0; sharedAttach(&s, argv[1]) != 0; tries++) {
+		if (tries == WAIT_SECONDS * 100) {
+			fprintf(stderr, "No render context %s\n", argv[1]);
+			exit(EXIT_FAILURE);
+		}
+		usleep(10000);
+	}
+	printf("Attached to %s: %dx%d, maximum iterations = %i\n", argv[1], s.h->width, s.h->height, s.h->maxIter);
+	fflush(stdout);
+
+	affinityInit();
+	for (i = 0; i < numProcess; i++) {
+		if (fork() == 0) {
+			pinWorker(i);
+			tiles = sharedWork(&s);
+			printf("Worker %d Finished %d tiles!\n", i, tiles);
+			exit(EXIT_SUCCESS);
+		}
+	}
+	for (i = 0; i < numProcess; i++) {
+		wait(NULL);
+	}
+	sharedClose(&s);
+	return (0);
+}